@@ -24,6 +24,13 @@
 #define UNUSED(x) x __attribute__((unused))
 #endif
 
+/* State of each request handling thread, e.g. the MIB snapshot pinned */
+#ifdef CONFIG_ENABLE_THREADS
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL
+#endif
+
 /* From The Practice of Programming, by Kernighan and Pike */
 #ifndef NELEMS
 #define NELEMS(array) (sizeof(array) / sizeof(array[0]))
@@ -37,6 +44,23 @@ int pidfile(const char *basename);
 int utimensat(int dirfd, const char *pathname, const struct timespec ts[2], int flags);
 #endif
 
+#ifndef HAVE_STRUCT_MMSGHDR
+#include <sys/socket.h>
+struct mmsghdr {
+	struct msghdr msg_hdr;
+	unsigned int  msg_len;
+};
+#endif
+
+#ifndef HAVE_RECVMMSG
+struct timespec;
+int recvmmsg(int sd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout);
+#endif
+
+#ifndef HAVE_SENDMMSG
+int sendmmsg(int sd, struct mmsghdr *msgvec, unsigned int vlen, int flags);
+#endif
+
 #ifndef HAVE_GETPROGNAME
 static inline char *getprogname(void)
 {
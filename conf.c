@@ -22,6 +22,24 @@
 
 static cfg_t *cfg = NULL;
 
+/*
+ * The strings and lists allocated by the last read_config(), freed when
+ * a reload replaces them.  Nothing else refers to them by then: the MIB
+ * has copies, and with threads the requests check the copies published
+ * with the MIB, see mib_community().
+ */
+static struct config {
+	char   *location;
+	char   *contact;
+	char   *description;
+	char   *community;
+	char   *vendor;
+	char  **disk_glob;
+	size_t  disk_glob_length;
+	char  **interface_glob;
+	size_t  interface_glob_length;
+} m_config;
+
 static void conf_errfunc(cfg_t *cfg, const char *format, va_list args)
 {
 	char fmt[80];
@@ -49,24 +67,112 @@ static char *get_string(cfg_t *cfg, const char *key)
 	return NULL;
 }
 
-static size_t get_list(cfg_t *cfg, const char *key, char **list, size_t len)
+static size_t get_list(cfg_t *cfg, const char *key, char ***list)
 {
-	size_t i = 0;
+	size_t i, len = 0;
+	char **arr;
+
+	arr = calloc(cfg_size(cfg, key) + 1, sizeof(*arr));
+	if (!arr) {
+		logit(LOG_ERR, errno, "Failed reading %s", key);
+		return 0;
+	}
 
-	while (i < cfg_size(cfg, key)) {
+	for (i = 0; i < cfg_size(cfg, key); i++) {
 		char *str;
 
 		str = cfg_getnstr(cfg, key, i);
-		if (str && i < len)
-			list[i++] = strdup(str);
+		if (str)
+			arr[len++] = strdup(str);
+	}
+	*list = arr;
+
+	return len;
+}
+
+static void free_list(char **list, size_t len)
+{
+	size_t i;
+
+	for (i = 0; list && i < len; i++)
+		free(list[i]);
+	free(list);
+}
+
+static void config_free(struct config *conf)
+{
+	free(conf->location);
+	free(conf->contact);
+	free(conf->description);
+	free(conf->community);
+	free(conf->vendor);
+	free_list(conf->disk_glob, conf->disk_glob_length);
+	free_list(conf->interface_glob, conf->interface_glob_length);
+	memset(conf, 0, sizeof(*conf));
+}
+
+static void set_refresh(cfg_t *cfg, cfg_opt_t *opts)
+{
+	cfg_opt_t *opt;
+
+	if (!cfg)
+		return;
+
+	for (opt = opts; opt->name; opt++)
+		mib_set_refresh(opt->name, cfg_getint(cfg, opt->name));
+}
+
+#ifdef CONFIG_ENABLE_RATES
+/* Windows not given keep their previous length, e.g. from the command line */
+static int get_rate_windows(cfg_t *cfg, unsigned int *window)
+{
+	size_t i;
+
+	memcpy(window, g_rate_window, sizeof(g_rate_window));
+	for (i = 0; i < cfg_size(cfg, "rate-windows"); i++) {
+		if (rate_window(window, i, cfg_getnint(cfg, "rate-windows", i)))
+			return 1;
 	}
 
-	return i;
+	return 0;
 }
+#endif
 
-int read_config(char *file)
+/*
+ * Read the .conf file, on reload all settings are parsed before any is
+ * changed, and the lazy mode, number of workers and maximum number of
+ * clients are left as they are
+ */
+int read_config(char *file, int reload)
 {
+	struct config conf;
+	int lazy = g_lazy, workers = g_workers, max_clients = g_max_clients;
+	int timeout;
 	int rc = 0;
+#ifdef CONFIG_ENABLE_RATES
+	unsigned int window[RATE_WINDOWS];
+#endif
+	cfg_opt_t refresh_opts[] = {
+		CFG_INT("system", 0, CFGF_NONE),
+		CFG_INT("interfaces", -1, CFGF_NONE),
+		CFG_INT("ip", -1, CFGF_NONE),
+		CFG_INT("ipaddr", -1, CFGF_NONE),
+		CFG_INT("tcp", -1, CFGF_NONE),
+		CFG_INT("udp", -1, CFGF_NONE),
+		CFG_INT("host", 0, CFGF_NONE),
+		CFG_INT("ifxtable", -1, CFGF_NONE),
+		CFG_INT("memory", -1, CFGF_NONE),
+		CFG_INT("disk", -1, CFGF_NONE),
+		CFG_INT("load", -1, CFGF_NONE),
+		CFG_INT("cpu", -1, CFGF_NONE),
+#ifdef CONFIG_ENABLE_RATES
+		CFG_INT("rates", -1, CFGF_NONE),
+#endif
+#ifdef CONFIG_ENABLE_DEMO
+		CFG_INT("demo", -1, CFGF_NONE),
+#endif
+		CFG_END()
+	};
 	cfg_opt_t ethtool_opts[] = {
 		CFG_STR("rx_bytes", NULL, CFGF_NONE),
 		CFG_STR("rx_mc_packets", NULL, CFGF_NONE),
@@ -88,10 +194,20 @@ int read_config(char *file)
 		CFG_STR ("description", NULL, CFGF_NONE),
 		CFG_BOOL("authentication", g_auth, CFGF_NONE),
 		CFG_STR ("community", NULL, CFGF_NONE),
-		CFG_INT ("timeout", g_timeout, CFGF_NONE),
+		CFG_INT ("timeout", g_timeout / 100, CFGF_NONE),
+		CFG_INT ("max-clients", g_max_clients, CFGF_NONE),
+		CFG_SEC ("refresh", refresh_opts, CFGF_NONE),
+#ifdef CONFIG_ENABLE_THREADS
+		CFG_INT ("workers", g_workers, CFGF_NONE),
+#else
+		CFG_BOOL("lazy", g_lazy, CFGF_NONE),
+#endif
 		CFG_STR ("vendor", VENDOR, CFGF_NONE),
 		CFG_STR_LIST("disk-table", "/", CFGF_NONE),
 		CFG_STR_LIST("iface-table", NULL, CFGF_NONE),
+#ifdef CONFIG_ENABLE_RATES
+		CFG_INT_LIST("rate-windows", NULL, CFGF_NONE),
+#endif
 		CFG_SEC("ethtool", ethtool_opts, CFGF_MULTI | CFGF_TITLE | CFGF_NO_TITLE_DUPES),
 		CFG_END()
 	};
@@ -122,18 +238,58 @@ int read_config(char *file)
 		break;
 	}
 
-	g_location    = get_string(cfg, "location");
-	g_contact     = get_string(cfg, "contact");
-	g_description = get_string(cfg, "description");
+#ifdef CONFIG_ENABLE_RATES
+	/* Before any setting is changed, to keep them all on a reload */
+	if (get_rate_windows(cfg, window)) {
+		rc = 1;
+		goto error;
+	}
+#endif
+
+	memset(&conf, 0, sizeof(conf));
+	conf.location    = get_string(cfg, "location");
+	conf.contact     = get_string(cfg, "contact");
+	conf.description = get_string(cfg, "description");
+	conf.community   = get_string(cfg, "community");
+	conf.vendor      = get_string(cfg, "vendor");
+	conf.disk_glob_length = get_list(cfg, "disk-table", &conf.disk_glob);
+	conf.interface_glob_length = get_list(cfg, "iface-table", &conf.interface_glob);
+
+	timeout = cfg_getint(cfg, "timeout");
+	max_clients = cfg_getint(cfg, "max-clients");
+#ifdef CONFIG_ENABLE_THREADS
+	workers = cfg_getint(cfg, "workers");
+#else
+	lazy    = cfg_getbool(cfg, "lazy");
+#endif
+
+	if (!reload) {
+		g_lazy    = lazy;
+		g_workers = workers;
+		g_max_clients = max_clients;
+	} else if (lazy != g_lazy || workers != g_workers || max_clients != g_max_clients) {
+		logit(LOG_WARNING, 0, "Changing lazy mode, workers or max-clients requires a restart");
+	}
 
-	g_disk_list_length = get_list(cfg, "disk-table", g_disk_list, NELEMS(g_disk_list));
-	g_interface_list_length = get_list(cfg, "iface-table", g_interface_list, NELEMS(g_interface_list));
+	g_location    = conf.location;
+	g_contact     = conf.contact;
+	g_description = conf.description;
+	g_community   = conf.community;
+	g_vendor      = conf.vendor;
+	g_disk_glob   = conf.disk_glob;
+	g_disk_glob_length = conf.disk_glob_length;
+	g_interface_glob   = conf.interface_glob;
+	g_interface_glob_length = conf.interface_glob_length;
 
 	g_auth        = cfg_getbool(cfg, "authentication");
-	g_community   = get_string(cfg, "community");
-	g_timeout     = cfg_getint(cfg, "timeout");
+	g_timeout     = timeout * 100;
+	set_refresh(cfg_getsec(cfg, "refresh"), refresh_opts);
+#ifdef CONFIG_ENABLE_RATES
+	memcpy(g_rate_window, window, sizeof(g_rate_window));
+#endif
 
-	g_vendor      = get_string(cfg, "vendor");
+	config_free(&m_config);
+	m_config = conf;
 
 	ethtool_xlate_cfg(cfg);
 
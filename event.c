@@ -0,0 +1,204 @@
+/* Event loop backends, epoll on Linux and kqueue on FreeBSD
+ *
+ * Copyright (C) 2015-2020  Joachim Nilsson <troglobit@gmail.com>
+ *
+ * This file may be distributed and/or modified under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.
+ *
+ * This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See COPYING for GPL licensing information.
+ */
+
+#include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#else
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+
+#include "mini-snmpd.h"
+
+/*
+ * All descriptors are edge-triggered, i.e., an event is only reported when
+ * new data arrives, so the handlers must read until EAGAIN.  Each event
+ * carries the arg given when the descriptor was added, so dispatching does
+ * not need to scan any client lists.
+ */
+static int ep = -1;
+
+int event_nonblock(int fd)
+{
+	int flags;
+
+	flags = fcntl(fd, F_GETFL, 0);
+	if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+		return -1;
+
+	return 0;
+}
+
+#ifdef __linux__
+static int tfd = -1;
+
+int event_init(void)
+{
+	ep = epoll_create1(EPOLL_CLOEXEC);
+	if (ep == -1) {
+		logit(LOG_ERR, errno, "Failed creating epoll descriptor");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int event_ctl(int op, int fd, void *arg, int write)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events   = (write ? EPOLLOUT : EPOLLIN) | EPOLLET;
+	ev.data.ptr = arg;
+
+	if (epoll_ctl(ep, op, fd, &ev)) {
+		logit(LOG_ERR, errno, "Failed %s descriptor %d in event loop",
+		      op == EPOLL_CTL_ADD ? "adding" : "modifying", fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+int event_add(int fd, void *arg)
+{
+	return event_ctl(EPOLL_CTL_ADD, fd, arg, 0);
+}
+
+/* Re-arming also reports data that arrived while waiting for the other */
+int event_mod(int fd, void *arg, int write)
+{
+	return event_ctl(EPOLL_CTL_MOD, fd, arg, write);
+}
+
+/* Arm the one-shot timer to expire in ticks (1/100 seconds) */
+int event_timer(int ticks, void *arg)
+{
+	struct itimerspec its;
+
+	if (tfd == -1) {
+		tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (tfd == -1) {
+			logit(LOG_ERR, errno, "Failed creating timer");
+			return -1;
+		}
+
+		if (event_add(tfd, arg))
+			return -1;
+	}
+
+	/*
+	 * Re-arming resets the expiration count, so the timerfd never has to
+	 * be read, and a zero it_value disarms it, so expire right away instead
+	 */
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec  = ticks / 100;
+	its.it_value.tv_nsec = (ticks % 100) * 10000000;
+	if (ticks <= 0)
+		its.it_value.tv_nsec = 1;
+
+	if (timerfd_settime(tfd, 0, &its, NULL)) {
+		logit(LOG_ERR, errno, "Failed arming timer");
+		return -1;
+	}
+
+	return 0;
+}
+
+int event_wait(event_t *event, int num)
+{
+	struct epoll_event ev[num];
+	int i, rc;
+
+	rc = epoll_wait(ep, ev, num, -1);
+	for (i = 0; i < rc; i++) {
+		event[i].arg   = ev[i].data.ptr;
+		event[i].write = (ev[i].events & EPOLLOUT) ? 1 : 0;
+	}
+
+	return rc;
+}
+
+#else /* kqueue */
+
+int event_init(void)
+{
+	ep = kqueue();
+	if (ep == -1) {
+		logit(LOG_ERR, errno, "Failed creating kqueue descriptor");
+		return -1;
+	}
+
+	return 0;
+}
+
+int event_add(int fd, void *arg)
+{
+	return event_mod(fd, arg, 0);
+}
+
+/* Only one of the read and write filters is enabled at a time */
+int event_mod(int fd, void *arg, int write)
+{
+	struct kevent kev[2];
+
+	EV_SET(&kev[0], fd, EVFILT_READ,  EV_ADD | EV_CLEAR | (write ? EV_DISABLE : EV_ENABLE), 0, 0, arg);
+	EV_SET(&kev[1], fd, EVFILT_WRITE, EV_ADD | EV_CLEAR | (write ? EV_ENABLE : EV_DISABLE), 0, 0, arg);
+	if (kevent(ep, kev, 2, NULL, 0, NULL)) {
+		logit(LOG_ERR, errno, "Failed adding descriptor %d to event loop", fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Arm the one-shot timer to expire in ticks (1/100 seconds) */
+int event_timer(int ticks, void *arg)
+{
+	struct kevent kev;
+
+	EV_SET(&kev, 0, EVFILT_TIMER, EV_ADD | EV_ONESHOT, 0, ticks > 0 ? ticks * 10 : 0, arg);
+	if (kevent(ep, &kev, 1, NULL, 0, NULL)) {
+		logit(LOG_ERR, errno, "Failed arming timer");
+		return -1;
+	}
+
+	return 0;
+}
+
+int event_wait(event_t *event, int num)
+{
+	struct kevent kev[num];
+	int i, rc;
+
+	rc = kevent(ep, NULL, 0, kev, num, NULL);
+	for (i = 0; i < rc; i++) {
+		event[i].arg   = kev[i].udata;
+		event[i].write = kev[i].filter == EVFILT_WRITE;
+	}
+
+	return rc;
+}
+
+#endif /* __linux__ */
+
+/* vim: ts=4 sts=4 sw=4 nowrap
+ */
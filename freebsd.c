@@ -155,7 +155,7 @@ void get_cpuinfo(cpuinfo_t *cpuinfo)
 	cpuinfo->cntxts = 0;	/* TODO */
 }
 
-void get_ipinfo(ipinfo_t *ipinfo)
+static void get_ipinfo(ipinfo_t *ipinfo)
 {
 	size_t len;
 
@@ -170,7 +170,7 @@ void get_ipinfo(ipinfo_t *ipinfo)
 	ipinfo->ipReasmTimeout = IPFRAGTTL;
 }
 
-void get_tcpinfo(tcpinfo_t *tcpinfo)
+static void get_tcpinfo(tcpinfo_t *tcpinfo)
 {
 	struct clockinfo clockinfo;
 	struct tcpstat tcps;
@@ -209,7 +209,7 @@ void get_tcpinfo(tcpinfo_t *tcpinfo)
 	tcpinfo->tcpOutRsts = tcps.tcps_sndctrl; /* Not just sent RSTs, includes SYN + FIN */
 }
 
-void get_udpinfo(udpinfo_t *udpinfo)
+static void get_udpinfo(udpinfo_t *udpinfo)
 {
 	struct udpstat udps;
 	size_t len = sizeof(udps);
@@ -230,6 +230,14 @@ void get_udpinfo(udpinfo_t *udpinfo)
 				    udps.udps_badsum +
 				    udps.udps_badlen);
 	udpinfo->udpOutDatagrams = udps.udps_opackets;
+	udpinfo->bits            = COUNTER_BITS(udps.udps_ipackets);
+}
+
+void get_protoinfo(protoinfo_t *protoinfo)
+{
+	get_ipinfo(&protoinfo->ip);
+	get_tcpinfo(&protoinfo->tcp);
+	get_udpinfo(&protoinfo->udp);
 }
 
 void get_diskinfo(diskinfo_t *diskinfo)
@@ -237,7 +245,7 @@ void get_diskinfo(diskinfo_t *diskinfo)
 	struct statfs fs;
 	size_t i;
 
-	memset(diskinfo, 0, sizeof(*diskinfo));
+	diskinfo_clear(diskinfo);
 	for (i = 0; i < g_disk_list_length; i++) {
 		if (statfs(g_disk_list[i], &fs) == -1)
 			continue;
@@ -255,11 +263,37 @@ void get_diskinfo(diskinfo_t *diskinfo)
 	}
 }
 
+/* The mount points of the system, for the disk patterns, see disk_discover() */
+int get_mounts(char ***list)
+{
+	struct statfs *fs;
+	char **arr;
+	int i, num, len = 0;
+
+	num = getmntinfo(&fs, MNT_NOWAIT);
+	if (num <= 0)
+		return -1;
+
+	arr = calloc(num + 1, sizeof(*arr));
+	if (!arr)
+		return -1;
+
+	for (i = 0; i < num; i++) {
+		arr[len] = strdup(fs[i].f_mntonname);
+		if (arr[len])
+			len++;
+	}
+
+	*list = arr;
+
+	return len;
+}
+
 void get_netinfo(netinfo_t *netinfo)
 {
 	struct ifaddrs *ifap, *ifa;
 
-	memset(netinfo, 0, sizeof(*netinfo));
+	netinfo_clear(netinfo);
 	if (getifaddrs(&ifap) < 0)
 		return;
 
@@ -333,6 +367,7 @@ void get_netinfo(netinfo_t *netinfo)
 			netinfo->tx_bc_packets[i] = 0;			/* XXX: Couldn't find at first glance */
 			netinfo->tx_errors[i]     = ifd->ifi_oerrors;
 			netinfo->tx_drops[i]      = ifd->ifi_collisions;
+			netinfo->stats[i]         = COUNTER_BITS(ifd->ifi_ibytes);
 			break;
 
 		case AF_INET:
@@ -30,7 +30,11 @@ int       g_auth    = 0;
 int       g_daemon  = 1;
 int       g_syslog  = 0;
 int       g_level   = LOG_NOTICE;
+int       g_lazy    = 0;
+int       g_workers = 1;
+int       g_max_clients = MAX_NR_CLIENTS;
 volatile sig_atomic_t g_quit = 0;
+volatile sig_atomic_t g_reload = 0;
 
 char     *g_prognm;
 char     *g_community;
@@ -41,23 +45,33 @@ char     *g_contact;
 char     *g_bind_to_device;
 char     *g_user;
 
-char     *g_disk_list[MAX_NR_DISKS] = { "/" };
-size_t    g_disk_list_length        = 1;
+char    **g_disk_glob               = (char *[]){ "/" };
+size_t    g_disk_glob_length        = 1;
 
-char     *g_interface_list[MAX_NR_INTERFACES];
+char    **g_disk_list;
+unsigned int *g_disk_index;
+size_t    g_disk_list_length;
+
+char    **g_interface_glob;
+size_t    g_interface_glob_length;
+
+char    **g_interface_list;
+unsigned int *g_interface_index;
 size_t    g_interface_list_length;
 
+#ifdef CONFIG_ENABLE_RATES
+unsigned int g_rate_window[RATE_WINDOWS] = { 60, 300, 900 };
+#endif
+
 in_port_t g_udp_port = 161;
 in_port_t g_tcp_port = 161;
 
 int       g_udp_sockfd = -1;
 int       g_tcp_sockfd = -1;
 
-client_t  g_udp_client;
-client_t *g_tcp_client_list[MAX_NR_CLIENTS];
-size_t    g_tcp_client_list_length;
+client_t  g_udp_client[MAX_NR_UDP_BATCH];
 
-value_t   g_mib[MAX_NR_VALUES];
+value_t  *g_mib;
 size_t    g_mib_length;
 
 /* vim: ts=4 sts=4 sw=4 nowrap
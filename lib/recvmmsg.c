@@ -0,0 +1,42 @@
+/* Replacement in case recvmmsg(2) is missing
+ *
+ * Copyright (C) 2020  Joachim Nilsson <troglobit@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _GNU_SOURCE		/* struct mmsghdr with GLIBC */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "compat.h"
+
+/* One recvmsg() per message, only the first one may block, no timeout */
+int
+recvmmsg(int sd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout)
+{
+	unsigned int i;
+	ssize_t len;
+
+	(void)timeout;
+
+	for (i = 0; i < vlen; i++) {
+		len = recvmsg(sd, &msgvec[i].msg_hdr, flags);
+		if (len == -1)
+			return i ? (int)i : -1;
+
+		msgvec[i].msg_len = len;
+		flags |= MSG_DONTWAIT;
+	}
+
+	return i;
+}
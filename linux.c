@@ -22,6 +22,7 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/vfs.h>
+#include <mntent.h>
 #include <net/if.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -87,11 +88,11 @@ void get_loadinfo(loadinfo_t *loadinfo)
 void get_meminfo(meminfo_t *meminfo)
 {
 	field_t fields[] = {
-		{ "MemTotal",  1, { &meminfo->total   }},
-		{ "MemFree",   1, { &meminfo->free    }},
-		{ "MemShared", 1, { &meminfo->shared  }},
-		{ "Buffers",   1, { &meminfo->buffers }},
-		{ "Cached",    1, { &meminfo->cached  }},
+		{ "MemTotal",  1, .value = { &meminfo->total   }},
+		{ "MemFree",   1, .value = { &meminfo->free    }},
+		{ "MemShared", 1, .value = { &meminfo->shared  }},
+		{ "Buffers",   1, .value = { &meminfo->buffers }},
+		{ "Cached",    1, .value = { &meminfo->cached  }},
 	};
 
 	memset(meminfo, 0, sizeof(meminfo_t));
@@ -101,20 +102,28 @@ void get_meminfo(meminfo_t *meminfo)
 void get_cpuinfo(cpuinfo_t *cpuinfo)
 {
 	field_t fields[] = {
-		{ "cpu ",  4, { &cpuinfo->user, &cpuinfo->nice, &cpuinfo->system, &cpuinfo->idle }},
-		{ "intr ", 1, { &cpuinfo->irqs   }},
-		{ "ctxt ", 1, { &cpuinfo->cntxts }},
+		{ "cpu ",  4, .value = { &cpuinfo->user, &cpuinfo->nice, &cpuinfo->system, &cpuinfo->idle }},
+		{ "intr ", 1, .value = { &cpuinfo->irqs   }},
+		{ "ctxt ", 1, .value = { &cpuinfo->cntxts }},
 	};
 
 	memset(cpuinfo, 0, sizeof(cpuinfo_t));
 	parse_file("/proc/stat", fields, NELEMS(fields), 0);
 }
 
-void get_ipinfo(ipinfo_t *ipinfo)
+/*
+ * The IP, TCP and UDP statistics all come from /proc/net/snmp, so read
+ * it once for all of them
+ */
+void get_protoinfo(protoinfo_t *protoinfo)
 {
+	ipinfo_t  *ipinfo  = &protoinfo->ip;
+	tcpinfo_t *tcpinfo = &protoinfo->tcp;
+	udpinfo_t *udpinfo = &protoinfo->udp;
 	long long garbage;
+	char *buf;
 	field_t fields[] = {
-		{ "Ip", 13,
+		{ "Ip", 13, .value =
 		  { &ipinfo->ipForwarding,
 		    &ipinfo->ipDefaultTTL,
 		    &garbage,
@@ -128,16 +137,7 @@ void get_ipinfo(ipinfo_t *ipinfo)
 		    &garbage,
 		    &garbage,
 		    &ipinfo->ipReasmTimeout } },
-	};
-
-	memset(ipinfo, 0, sizeof(ipinfo_t));
-	parse_file("/proc/net/snmp", fields, NELEMS(fields), 1);
-}
-
-void get_tcpinfo(tcpinfo_t *tcpinfo)
-{
-	field_t fields[] = {
-		{ "Tcp", 14,
+		{ "Tcp", 14, .value =
 		  { &tcpinfo->tcpRtoAlgorithm,
 		    &tcpinfo->tcpRtoMin,
 		    &tcpinfo->tcpRtoMax,
@@ -152,33 +152,28 @@ void get_tcpinfo(tcpinfo_t *tcpinfo)
 		    &tcpinfo->tcpRetransSegs,
 		    &tcpinfo->tcpInErrs,
 		    &tcpinfo->tcpOutRsts } },
-	};
-
-	if (parse_file("/proc/net/snmp", fields, NELEMS(fields), 1))
-		memset(tcpinfo, 0, sizeof(tcpinfo_t));
-}
-
-void get_udpinfo(udpinfo_t *udpinfo)
-{
-	field_t fields[] = {
-		{ "Udp", 4,
+		{ "Udp", 4, .counter =
 		  { &udpinfo->udpInDatagrams,
 		    &udpinfo->udpNoPorts,
 		    &udpinfo->udpInErrors,
 		    &udpinfo->udpOutDatagrams } },
 	};
 
-	if (parse_file("/proc/net/snmp", fields, NELEMS(fields), 1))
-		memset(udpinfo, 0, sizeof(udpinfo_t));
-}
+	memset(protoinfo, 0, sizeof(*protoinfo));
+	buf = read_file_cached("/proc/net/snmp");
+	if (!buf)
+		return;
 
+	parse_text(buf, fields, NELEMS(fields));
+	udpinfo->bits = COUNTER_BITS(long);
+}
 
 void get_diskinfo(diskinfo_t *diskinfo)
 {
 	struct statfs fs;
 	size_t i;
 
-	memset(diskinfo, 0, sizeof(*diskinfo));
+	diskinfo_clear(diskinfo);
 	for (i = 0; i < g_disk_list_length; i++) {
 		if (statfs(g_disk_list[i], &fs) == -1)
 			continue;
@@ -196,16 +191,50 @@ void get_diskinfo(diskinfo_t *diskinfo)
 	}
 }
 
+/* The mount points of the system, for the disk patterns, see disk_discover() */
+int get_mounts(char ***list)
+{
+	struct mntent *ent;
+	char **arr = NULL;
+	int len = 0;
+	FILE *fp;
+
+	fp = setmntent("/proc/self/mounts", "r");
+	if (!fp)
+		return -1;
+
+	while ((ent = getmntent(fp))) {
+		char **tmp;
+
+		tmp = realloc(arr, (len + 1) * sizeof(*arr));
+		if (!tmp)
+			break;
+
+		arr = tmp;
+		arr[len] = strdup(ent->mnt_dir);
+		if (arr[len])
+			len++;
+	}
+	endmntent(fp);
+
+	*list = arr;
+
+	return len;
+}
+
 void get_netinfo(netinfo_t *netinfo)
 {
 	struct ifaddrs *ifap, *ifa;
-	field_t fields[MAX_NR_INTERFACES + 1];
+	field_t fields[g_interface_list_length + 1];
+
+	if (!netlink_netinfo(netinfo))
+		return;
 
 	if (getifaddrs(&ifap) < 0)
 		return;
 
 	memset(fields, 0, sizeof(fields));
-	memset(netinfo, 0, sizeof(*netinfo));
+	netinfo_clear(netinfo);
 
 	for (ifa = ifap; ifa; ifa = ifa->ifa_next) {
 		struct sockaddr_in *addr, *mask, *bcaddr;
@@ -266,15 +295,15 @@ void get_netinfo(netinfo_t *netinfo)
 				/* XXX: Tx multicast and Rx/Tx broadcast not available atm. */
 				fields[i].prefix    = g_interface_list[i];
 				fields[i].len       = 12;
-				fields[i].value[0]  = &netinfo->rx_bytes[i];
-				fields[i].value[1]  = &netinfo->rx_packets[i];
-				fields[i].value[2]  = &netinfo->rx_errors[i];
-				fields[i].value[3]  = &netinfo->rx_drops[i];
-				fields[i].value[7]  = &netinfo->rx_mc_packets[i];
-				fields[i].value[8]  = &netinfo->tx_bytes[i];
-				fields[i].value[9]  = &netinfo->tx_packets[i];
-				fields[i].value[10] = &netinfo->tx_errors[i];
-				fields[i].value[11] = &netinfo->tx_drops[i];
+				fields[i].counter[0]  = &netinfo->rx_bytes[i];
+				fields[i].counter[1]  = &netinfo->rx_packets[i];
+				fields[i].counter[2]  = &netinfo->rx_errors[i];
+				fields[i].counter[3]  = &netinfo->rx_drops[i];
+				fields[i].counter[7]  = &netinfo->rx_mc_packets[i];
+				fields[i].counter[8]  = &netinfo->tx_bytes[i];
+				fields[i].counter[9]  = &netinfo->tx_packets[i];
+				fields[i].counter[10] = &netinfo->tx_errors[i];
+				fields[i].counter[11] = &netinfo->tx_drops[i];
 			}
 
 			if (-1 == read_file_value(&netinfo->if_mtu[i], "/sys/class/net/%s/mtu", g_interface_list[i]))
@@ -288,7 +317,9 @@ void get_netinfo(netinfo_t *netinfo)
 
 			/* XXX: Need better tracking on Linux, c.f. FreeBSD ... */
 			netinfo->lastchange[1] = get_process_uptime();
-			netinfo->stats[i] = 1;
+
+			/* The unsigned long counters of the driver */
+			netinfo->stats[i] = COUNTER_BITS(long);
 		}
 	}
 
@@ -42,6 +42,7 @@ typedef int32_t s32;
 
 /* counter offsets and number of counters per interface */
 static struct ethtool_s {
+	unsigned int ifindex;
 	int n_stats;
 	int rx_bytes;
 	int rx_mc_packets;
@@ -55,7 +56,26 @@ static struct ethtool_s {
 	int tx_packets;
 	int tx_errors;
 	int tx_drops;
-} ethtool[MAX_NR_INTERFACES];
+} *ethtool;
+static size_t ethtool_len;
+
+/* ethtool sections of the config, applied to each matching interface */
+static struct ethtool_rule {
+	char *iname;
+	char *rx_bytes;
+	char *rx_mc_packets;
+	char *rx_bc_packets;
+	char *rx_packets;
+	char *rx_errors;
+	char *rx_drops;
+	char *tx_bytes;
+	char *tx_mc_packets;
+	char *tx_bc_packets;
+	char *tx_packets;
+	char *tx_errors;
+	char *tx_drops;
+} *rules;
+static size_t rules_len;
 
 /* ethtool socket */
 static int fd = -1;
@@ -65,8 +85,11 @@ static int ethtool_init()
 	fd = socket(AF_INET, SOCK_DGRAM, 0);
 	if (fd < 0)
 		fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_GENERIC);
-	if (fd < 0)
+	if (fd < 0) {
 		logit(LOG_ERR, errno, "Cannot get control socket");
+		return fd;
+	}
+
 	return fd;
 }
 
@@ -125,11 +148,11 @@ static int ethtool_match_string(const char *key, struct ethtool_gstrings *string
 }
 
 #define ethtool_parse_opt(_name)													\
-	ethtool[intf]._name = ethtool_match_string(cfg_getstr(cfg, #_name), strings);	\
+	ethtool[intf]._name = ethtool_match_string(rule->_name, strings);				\
 	if (ethtool[intf]._name >= 0)										       		\
 		found = 1;
 
-static void ethtool_xlate_intf(cfg_t *cfg, int intf, const char *iname)
+static void ethtool_xlate_intf(const struct ethtool_rule *rule, int intf, const char *iname)
 {
 	struct ethtool_gstrings *strings = get_stringset(iname);
 	int found = 0;
@@ -161,36 +184,121 @@ static void ethtool_xlate_intf(cfg_t *cfg, int intf, const char *iname)
 	free(strings);
 }
 
-void ethtool_xlate_cfg(cfg_t *cfg)
+/*
+ * One entry per monitored interface, in the order of the interface list.
+ * When interfaces are added or removed the entries of the others are kept,
+ * new interfaces get the last ethtool section matching their name, or no
+ * stats if none does.
+ */
+static int ethtool_sync(void)
 {
-	cfg_t *ethtool;
-	const char *iname;
-	unsigned int i, j;
-	int intf;
+	struct ethtool_s *old = ethtool;
+	size_t i, j, old_len = ethtool_len;
 
-	if (ethtool_init() < 0)
-		return;
+	ethtool = calloc(g_interface_list_length + 1, sizeof(*ethtool));
+	if (!ethtool) {
+		logit(LOG_ERR, errno, "Cannot allocate ethtool table");
+		ethtool = old;
+		return -1;
+	}
+	ethtool_len = g_interface_list_length;
 
-	for (i = 0; i < cfg_size(cfg, "ethtool"); i++) {
-		ethtool = cfg_getnsec(cfg, "ethtool", i);
-		iname = cfg_title(ethtool);
-		logit(LOG_INFO, 0, "Parsing ethtool section '%s'", iname);
+	for (i = 0; i < ethtool_len; i++) {
+		ethtool[i].ifindex = g_interface_index[i];
 
-		/* exact match? */
-		intf = find_ifname((char *)iname);
-		if (intf >= 0) {
-			ethtool_xlate_intf(ethtool, intf, iname);
+		for (j = 0; j < old_len; j++) {
+			if (old[j].ifindex == ethtool[i].ifindex)
+				break;
+		}
+		if (j < old_len) {
+			ethtool[i] = old[j];
 			continue;
 		}
 
-		/* or wildcard match? */
-		if (strcspn(iname, "*?[")) {
-			for (j = 0; j < g_interface_list_length; j++) {
-				if (!fnmatch(iname, g_interface_list[j], 0))
-					ethtool_xlate_intf(ethtool, j, g_interface_list[j]);
+		for (j = rules_len; j > 0; j--) {
+			if (rules[j - 1].iname && !fnmatch(rules[j - 1].iname, g_interface_list[i], 0)) {
+				ethtool_xlate_intf(&rules[j - 1], i, g_interface_list[i]);
+				break;
 			}
 		}
 	}
+	free(old);
+
+	return 0;
+}
+
+static void ethtool_free_rules(void)
+{
+	size_t i;
+
+	for (i = 0; i < rules_len; i++) {
+		free(rules[i].iname);
+		free(rules[i].rx_bytes);
+		free(rules[i].rx_mc_packets);
+		free(rules[i].rx_bc_packets);
+		free(rules[i].rx_packets);
+		free(rules[i].rx_errors);
+		free(rules[i].rx_drops);
+		free(rules[i].tx_bytes);
+		free(rules[i].tx_mc_packets);
+		free(rules[i].tx_bc_packets);
+		free(rules[i].tx_packets);
+		free(rules[i].tx_errors);
+		free(rules[i].tx_drops);
+	}
+	free(rules);
+
+	rules     = NULL;
+	rules_len = 0;
+}
+
+#define ethtool_copy_opt(_name)								\
+	if (cfg_getstr(ethtool, #_name))						\
+		rules[i]._name = strdup(cfg_getstr(ethtool, #_name));
+
+/*
+ * Called again when the .conf file is reloaded, then the sections replace
+ * the previous ones and all interfaces are translated again, on the next
+ * ethtool_gstats(), since their section may have changed.
+ */
+void ethtool_xlate_cfg(cfg_t *cfg)
+{
+	cfg_t *ethtool;
+	unsigned int i;
+
+	if (fd < 0 && ethtool_init() < 0)
+		return;
+
+	ethtool_free_rules();
+	ethtool_len = 0;
+
+	rules_len = cfg_size(cfg, "ethtool");
+	rules = calloc(rules_len + 1, sizeof(*rules));
+	if (!rules) {
+		logit(LOG_ERR, errno, "Cannot allocate ethtool sections");
+		rules_len = 0;
+		return;
+	}
+
+	/* Kept, the interfaces are only known, and may come and go, later */
+	for (i = 0; i < rules_len; i++) {
+		ethtool = cfg_getnsec(cfg, "ethtool", i);
+		rules[i].iname = strdup(cfg_title(ethtool));
+		logit(LOG_INFO, 0, "Parsing ethtool section '%s'", cfg_title(ethtool));
+
+		ethtool_copy_opt(rx_bytes);
+		ethtool_copy_opt(rx_mc_packets);
+		ethtool_copy_opt(rx_bc_packets);
+		ethtool_copy_opt(rx_packets);
+		ethtool_copy_opt(rx_errors);
+		ethtool_copy_opt(rx_drops);
+		ethtool_copy_opt(tx_bytes);
+		ethtool_copy_opt(tx_mc_packets);
+		ethtool_copy_opt(tx_bc_packets);
+		ethtool_copy_opt(tx_packets);
+		ethtool_copy_opt(tx_errors);
+		ethtool_copy_opt(tx_drops);
+	}
 }
 
 #define set_val(_fieldnum, _name)													\
@@ -198,7 +306,7 @@ void ethtool_xlate_cfg(cfg_t *cfg)
 		netinfo->_name[intf] = stats->data[ethtool[intf]._name];					\
 	else if (_fieldnum >= 0) {														\
 			fallback = 1;															\
-			field->value[_fieldnum] = &netinfo->_name[intf];						\
+			field->counter[_fieldnum] = &netinfo->_name[intf];					\
 	}
 
 int ethtool_gstats(int intf, netinfo_t *netinfo, field_t *field)
@@ -210,6 +318,9 @@ int ethtool_gstats(int intf, netinfo_t *netinfo, field_t *field)
 
 	if (fd < 0)
 		return fd;
+	if ((ethtool_len != g_interface_list_length || ethtool[intf].ifindex != g_interface_index[intf]) &&
+	    ethtool_sync())
+		return -1;
 	if (!ethtool[intf].n_stats)
 		return -1;
 
@@ -0,0 +1,644 @@
+/* Linux rtnetlink backend for interface statistics
+ *
+ * Copyright (C) 2015-2020  Joachim Nilsson <troglobit@gmail.com>
+ *
+ * This file may be distributed and/or modified under the terms of the
+ * GNU General Public License version 2 as published by the Free Software
+ * Foundation and appearing in the file LICENSE.GPL included in the
+ * packaging of this file.
+ *
+ * This file is provided AS IS with NO WARRANTY OF ANY KIND, INCLUDING THE
+ * WARRANTY OF DESIGN, MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See COPYING for GPL licensing information.
+ */
+#ifdef __linux__
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <net/if.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+
+#include "mini-snmpd.h"
+
+#ifdef CONFIG_ENABLE_NETLINK
+
+/* From linux/if.h, which cannot be included along with net/if.h */
+#ifndef IF_OPER_UP
+#define IF_OPER_UNKNOWN        0
+#define IF_OPER_NOTPRESENT     1
+#define IF_OPER_DOWN           2
+#define IF_OPER_LOWERLAYERDOWN 3
+#define IF_OPER_TESTING        4
+#define IF_OPER_DORMANT        5
+#define IF_OPER_UP             6
+#endif
+
+/*
+ * Instead of getifaddrs(), which dumps all links and addresses, and then
+ * parsing all of /proc/net/dev, ask the kernel for each of the monitored
+ * interfaces only.  The RTM_GETLINK requests are sent in batches, each in
+ * one message, and the kernel has queued all replies when send() returns.
+ */
+struct link_req {
+	struct nlmsghdr  nh;
+	struct ifinfomsg ifi;
+	char             attr[RTA_SPACE(IFNAMSIZ)];
+};
+
+/* Requests per batch, the replies of about 1 kiB each fit the socket buffer */
+#define LINK_BATCH 32
+
+/*
+ * Link state and IPv4 address of each monitored interface, kept up to
+ * date by the RTNLGRP_LINK and RTNLGRP_IPV4_IFADDR notifications read in
+ * netlink_event(), or by polling if the event socket cannot be opened.
+ * The speed is read from /sys when the interface is first seen and again
+ * after each change of its state, e.g. when the carrier comes up.
+ */
+struct link_state {
+	unsigned int ifindex;
+	unsigned int status;
+	unsigned int lastchange;
+	unsigned int speed;	/* In bps, 0 until read */
+	unsigned int in_addr;
+	unsigned int in_mask;
+	unsigned int in_bcaddr;
+	unsigned int in_bcent;
+};
+
+static struct link_state *m_link;
+static size_t m_link_length;
+static int m_resync = 1;	/* Addresses must be dumped */
+
+static int sd = -1;		/* Requests */
+static int ev = -1;		/* Notifications */
+static unsigned int seq;
+
+static int netlink_open(unsigned int groups)
+{
+	struct sockaddr_nl sa;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (fd < 0) {
+		logit(LOG_WARNING, errno, "Failed opening netlink socket");
+		return -1;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.nl_family = AF_NETLINK;
+	sa.nl_groups = groups;
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa))) {
+		logit(LOG_WARNING, errno, "Failed binding netlink socket");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+ * One link state per monitored interface, in the order of the interface
+ * list.  When interfaces are added or removed the state of the others is
+ * kept, an interface added after we started has changed when created.
+ */
+static int link_sync(void)
+{
+	struct link_state *link;
+	size_t i, j, len = g_interface_list_length;
+
+	for (i = 0; i < len && len == m_link_length; i++) {
+		if (m_link[i].ifindex != g_interface_index[i])
+			break;
+	}
+	if (len == m_link_length && i == len && m_link)
+		return 0;
+
+	link = calloc(len + 1, sizeof(*link));
+	if (!link) {
+		logit(LOG_ERR, errno, "Failed allocating link state");
+		return -1;
+	}
+
+	for (i = 0; i < len; i++) {
+		for (j = 0; j < m_link_length; j++) {
+			if (m_link[j].ifindex == g_interface_index[i])
+				break;
+		}
+
+		if (j < m_link_length)
+			link[i] = m_link[j];
+		else if (m_link)
+			link[i].lastchange = get_process_uptime();
+		link[i].ifindex = g_interface_index[i];
+	}
+
+	free(m_link);
+	m_link        = link;
+	m_link_length = len;
+
+	return 0;
+}
+
+/* Kernel replies are already queued, so never block waiting for more */
+static ssize_t netlink_recv(int fd, char *buf, size_t len)
+{
+	ssize_t num;
+
+	num = recv(fd, buf, len, MSG_DONTWAIT);
+	if (num < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS)
+		logit(LOG_WARNING, errno, "Failed reading netlink message");
+
+	return num;
+}
+
+static unsigned int operstatus(unsigned int flags, int operstate)
+{
+	if (!(flags & IFF_UP))
+		return 2;	/* down(2) */
+
+	switch (operstate) {
+	case IF_OPER_UP:
+		return 1;	/* up(1) */
+	case IF_OPER_TESTING:
+		return 3;	/* testing(3) */
+	case IF_OPER_DORMANT:
+		return 5;	/* dormant(5) */
+	case IF_OPER_NOTPRESENT:
+		return 6;	/* notPresent(6) */
+	case IF_OPER_DOWN:
+	case IF_OPER_LOWERLAYERDOWN:
+		return 7;	/* lowerLayerDown(7) */
+	default:
+		break;
+	}
+
+	/* Unknown, e.g. loopback and most virtual interfaces, use the flags */
+	return (flags & IFF_RUNNING) ? 1 : 7;
+}
+
+/*
+ * ifLastChange is the sysUpTime of the last change, a change before we
+ * started, i.e., the first time we see the interface, is reported as 0.
+ */
+static int link_status(int i, unsigned int ifindex, unsigned int status)
+{
+	struct link_state *link = &m_link[i];
+
+	link->ifindex = ifindex;
+	if (link->status == status)
+		return 0;
+
+	if (link->status)
+		link->lastchange = get_process_uptime();
+	link->status = status;
+	link->speed  = 0;
+
+	return 1;
+}
+
+static void link_addr_clear(int i)
+{
+	m_link[i].in_addr   = 0;
+	m_link[i].in_mask   = 0;
+	m_link[i].in_bcaddr = 0;
+	m_link[i].in_bcent  = 0;
+}
+
+/* Called with netinfo NULL for notifications, only the state is updated */
+static int parse_link(netinfo_t *netinfo, int i, struct nlmsghdr *nh)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA(nh);
+	struct rtnl_link_stats64 st;
+	struct rtattr *rta;
+	field_t field;
+	int operstate = IF_OPER_UNKNOWN;
+	int len = IFLA_PAYLOAD(nh);
+	int has_stats = 0;
+	int changed;
+
+	if (nh->nlmsg_type == RTM_DELLINK) {
+		link_addr_clear(i);
+		return link_status(i, ifi->ifi_index, 6); /* notPresent(6) */
+	}
+
+	for (rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		size_t plen = RTA_PAYLOAD(rta);
+
+		switch (rta->rta_type) {
+		case IFLA_OPERSTATE:
+			operstate = *(unsigned char *)RTA_DATA(rta);
+			break;
+		}
+
+		if (!netinfo)
+			continue;
+
+		switch (rta->rta_type) {
+		case IFLA_MTU:
+			memcpy(&netinfo->if_mtu[i], RTA_DATA(rta), sizeof(netinfo->if_mtu[i]));
+			break;
+
+		case IFLA_ADDRESS:
+			if (plen > sizeof(netinfo->mac_addr[i]))
+				plen = sizeof(netinfo->mac_addr[i]);
+			memcpy(netinfo->mac_addr[i], RTA_DATA(rta), plen);
+			break;
+
+		case IFLA_STATS64:
+			memset(&st, 0, sizeof(st));
+			if (plen > sizeof(st))
+				plen = sizeof(st);
+			memcpy(&st, RTA_DATA(rta), plen);
+			has_stats = 1;
+			break;
+		}
+	}
+
+	changed = link_status(i, ifi->ifi_index, operstatus(ifi->ifi_flags, operstate));
+	if (!netinfo)
+		return changed;
+
+	if (ifi->ifi_flags & IFF_POINTOPOINT)
+		netinfo->if_type[i] = 23; /* ppp(23) */
+	else if (ifi->ifi_flags & IFF_LOOPBACK)
+		netinfo->if_type[i] = 24; /* softwareLoopback(24) */
+	else
+		netinfo->if_type[i] = 6; /* ethernetCsmacd(6) */
+
+	netinfo->stats[i] = COUNTER_BITS(st.rx_bytes);
+
+	if (!m_link[i].speed) {
+		if (-1 == read_file_value(&m_link[i].speed, "/sys/class/net/%s/speed", g_interface_list[i]))
+			m_link[i].speed = 1000; /* Fallback */
+		m_link[i].speed *= 1000000;     /* to bps */
+	}
+	netinfo->if_speed[i] = m_link[i].speed;
+
+	if (!has_stats)
+		return changed;
+
+	/*
+	 * Counters not provided by ethtool are set in the order of the
+	 * columns in /proc/net/dev, which is where they come from otherwise
+	 */
+	memset(&field, 0, sizeof(field));
+	if (ethtool_gstats(i, netinfo, &field) < 0) {
+		field.counter[0]  = &netinfo->rx_bytes[i];
+		field.counter[1]  = &netinfo->rx_packets[i];
+		field.counter[2]  = &netinfo->rx_errors[i];
+		field.counter[3]  = &netinfo->rx_drops[i];
+		field.counter[7]  = &netinfo->rx_mc_packets[i];
+		field.counter[8]  = &netinfo->tx_bytes[i];
+		field.counter[9]  = &netinfo->tx_packets[i];
+		field.counter[10] = &netinfo->tx_errors[i];
+		field.counter[11] = &netinfo->tx_drops[i];
+	}
+
+	if (field.counter[0])  *field.counter[0]  = st.rx_bytes;
+	if (field.counter[1])  *field.counter[1]  = st.rx_packets;
+	if (field.counter[2])  *field.counter[2]  = st.rx_errors;
+	if (field.counter[3])  *field.counter[3]  = st.rx_dropped;
+	if (field.counter[7])  *field.counter[7]  = st.multicast;
+	if (field.counter[8])  *field.counter[8]  = st.tx_bytes;
+	if (field.counter[9])  *field.counter[9]  = st.tx_packets;
+	if (field.counter[10]) *field.counter[10] = st.tx_errors;
+	if (field.counter[11]) *field.counter[11] = st.tx_dropped;
+
+	return changed;
+}
+
+/* Send one batch of requests, starting with the interface at first */
+static int get_link_batch(netinfo_t *netinfo, size_t first, size_t num)
+{
+	struct link_req req[LINK_BATCH];
+	unsigned int base = seq + 1;
+	char buf[16384];
+	size_t i, pending;
+
+	memset(req, 0, num * sizeof(req[0]));
+	for (i = 0; i < num; i++) {
+		const char *ifname = g_interface_list[first + i];
+		struct rtattr *rta;
+
+		req[i].nh.nlmsg_len   = sizeof(req[i]);
+		req[i].nh.nlmsg_type  = RTM_GETLINK;
+		req[i].nh.nlmsg_flags = NLM_F_REQUEST;
+		req[i].nh.nlmsg_seq   = ++seq;
+		req[i].ifi.ifi_family = AF_UNSPEC;
+
+		rta = (struct rtattr *)req[i].attr;
+		rta->rta_type = IFLA_IFNAME;
+		rta->rta_len  = RTA_LENGTH(strlen(ifname) + 1);
+		strncpy(RTA_DATA(rta), ifname, IFNAMSIZ - 1);
+	}
+
+	if (send(sd, req, num * sizeof(req[0]), 0) < 0) {
+		logit(LOG_WARNING, errno, "Failed sending netlink request");
+		return -1;
+	}
+
+	/* One reply per interface, a link or an error if it does not exist */
+	pending = num;
+	while (pending > 0) {
+		struct nlmsghdr *nh;
+		ssize_t len;
+
+		len = netlink_recv(sd, buf, sizeof(buf));
+		if (len <= 0)
+			break;
+
+		for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+			if (nh->nlmsg_seq < base || nh->nlmsg_seq >= base + num)
+				continue;
+
+			i = first + nh->nlmsg_seq - base;
+			if (nh->nlmsg_type == RTM_NEWLINK)
+				parse_link(netinfo, i, nh);
+			else
+				link_status(i, m_link[i].ifindex, 6); /* notPresent(6) */
+			pending--;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * The requests are sent in batches, so the replies queued for us never
+ * exceed the socket buffer, however many interfaces are monitored.
+ */
+static int get_links(netinfo_t *netinfo)
+{
+	size_t i, num;
+
+	for (i = 0; i < g_interface_list_length; i += num) {
+		num = g_interface_list_length - i;
+		if (num > LINK_BATCH)
+			num = LINK_BATCH;
+
+		if (get_link_batch(netinfo, i, num))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int find_ifindex(unsigned int ifindex)
+{
+	size_t i;
+
+	for (i = 0; i < g_interface_list_length; i++) {
+		if (m_link[i].ifindex == ifindex)
+			return i;
+	}
+
+	return -1;
+}
+
+static int parse_addr(struct nlmsghdr *nh)
+{
+	struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+	struct rtattr *rta;
+	unsigned int addr = 0, bcaddr = 0;
+	int len = IFA_PAYLOAD(nh);
+	int i;
+
+	if (ifa->ifa_family != AF_INET)
+		return 0;
+
+	i = find_ifindex(ifa->ifa_index);
+	if (i == -1)
+		return 0;
+
+	for (rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+		switch (rta->rta_type) {
+		case IFA_ADDRESS:
+			/* On point-to-point links this is the peer, prefer IFA_LOCAL */
+			if (!addr)
+				memcpy(&addr, RTA_DATA(rta), sizeof(addr));
+			break;
+
+		case IFA_LOCAL:
+			memcpy(&addr, RTA_DATA(rta), sizeof(addr));
+			break;
+
+		case IFA_BROADCAST:
+			memcpy(&bcaddr, RTA_DATA(rta), sizeof(bcaddr));
+			break;
+		}
+	}
+
+	/* Another address may remain, fetch them all on the next poll */
+	if (nh->nlmsg_type == RTM_DELADDR) {
+		if (m_link[i].in_addr != ntohl(addr))
+			return 0;
+
+		link_addr_clear(i);
+		m_resync = 1;
+		return 1;
+	}
+
+	m_link[i].in_addr   = ntohl(addr);
+	m_link[i].in_mask   = ifa->ifa_prefixlen ? 0xFFFFFFFF << (32 - ifa->ifa_prefixlen) : 0;
+	m_link[i].in_bcaddr = ntohl(bcaddr);
+	m_link[i].in_bcent  = bcaddr ? 1 : 0;
+
+	return 1;
+}
+
+static int get_addrs(void)
+{
+	struct {
+		struct nlmsghdr  nh;
+		struct ifaddrmsg ifa;
+	} req;
+	char buf[16384];
+	size_t i;
+
+	memset(&req, 0, sizeof(req));
+	req.nh.nlmsg_len   = sizeof(req);
+	req.nh.nlmsg_type  = RTM_GETADDR;
+	req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nh.nlmsg_seq   = ++seq;
+	req.ifa.ifa_family = AF_INET;
+
+	if (send(sd, &req, sizeof(req), 0) < 0) {
+		logit(LOG_WARNING, errno, "Failed sending netlink request");
+		return -1;
+	}
+
+	for (i = 0; i < g_interface_list_length; i++)
+		link_addr_clear(i);
+	m_resync = 0;
+
+	while (1) {
+		struct nlmsghdr *nh;
+		ssize_t len;
+
+		len = netlink_recv(sd, buf, sizeof(buf));
+		if (len <= 0)
+			return 0;
+
+		for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+			if (nh->nlmsg_seq != req.nh.nlmsg_seq)
+				continue;
+
+			if (nh->nlmsg_type == NLMSG_DONE || nh->nlmsg_type == NLMSG_ERROR)
+				return 0;
+
+			if (nh->nlmsg_type == RTM_NEWADDR)
+				parse_addr(nh);
+		}
+	}
+}
+
+static void link_copy(netinfo_t *netinfo)
+{
+	size_t i;
+
+	for (i = 0; i < g_interface_list_length; i++) {
+		netinfo->ifindex[i]    = m_link[i].ifindex;
+		netinfo->status[i]     = m_link[i].status;
+		netinfo->lastchange[i] = m_link[i].lastchange;
+		netinfo->in_addr[i]    = m_link[i].in_addr;
+		netinfo->in_mask[i]    = m_link[i].in_mask;
+		netinfo->in_bcaddr[i]  = m_link[i].in_bcaddr;
+		netinfo->in_bcent[i]   = m_link[i].in_bcent;
+	}
+}
+
+/* Returns -1 if netlink cannot be used, then fall back to /proc/net/dev */
+int netlink_netinfo(netinfo_t *netinfo)
+{
+	if (sd < 0) {
+		sd = netlink_open(0);
+		if (sd < 0)
+			return -1;
+	}
+
+	netinfo_clear(netinfo);
+	if (g_interface_list_length == 0)
+		return 0;
+
+	if (link_sync())
+		return -1;
+
+	/* Without notifications addresses are polled as well */
+	if (get_links(netinfo) || ((ev < 0 || m_resync) && get_addrs())) {
+		close(sd);
+		sd = -1;
+		return -1;
+	}
+	link_copy(netinfo);
+
+	return 0;
+}
+
+/*
+ * Subscribe to link and IPv4 address notifications, returns the socket
+ * to wait on, or -1 if link state and addresses must be polled.
+ */
+int netlink_event_open(void)
+{
+	if (ev < 0) {
+		ev = netlink_open(RTMGRP_LINK | RTMGRP_IPV4_IFADDR);
+
+		/* Changes before we subscribed are picked up on the next poll */
+		m_resync = 1;
+	}
+
+	return ev;
+}
+
+/*
+ * Read all pending notifications for the monitored interfaces.  Returns 1
+ * and the current link state and addresses in netinfo if any of them has
+ * changed, 0 if not and -1 on error.  Returns 2 if an interface to monitor
+ * has been created, removed or renamed, the interfaces must be discovered
+ * again, see interface_discover(), and netinfo is not up to date.
+ */
+int netlink_event(netinfo_t *netinfo)
+{
+	char buf[16384];
+	int changed = 0;
+	int relink = 0;
+
+	if (ev < 0 || link_sync())
+		return -1;
+
+	while (1) {
+		struct nlmsghdr *nh;
+		ssize_t len;
+
+		len = netlink_recv(ev, buf, sizeof(buf));
+		if (len < 0 && errno == ENOBUFS) {
+			/* Notifications lost, poll everything again */
+			logit(LOG_NOTICE, 0, "Netlink notifications lost, resyncing");
+			if (sd >= 0 && !get_links(NULL) && !get_addrs())
+				changed = 1;
+			continue;
+		}
+		if (len <= 0)
+			break;
+
+		for (nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len)) {
+			struct ifinfomsg *ifi;
+			struct rtattr *rta;
+			int rlen, i = -1;
+
+			switch (nh->nlmsg_type) {
+			case RTM_NEWLINK:
+			case RTM_DELLINK:
+				/* Match on name, the ifindex changes if re-created */
+				ifi  = NLMSG_DATA(nh);
+				rlen = IFLA_PAYLOAD(nh);
+				for (rta = IFLA_RTA(ifi); RTA_OK(rta, rlen); rta = RTA_NEXT(rta, rlen)) {
+					if (rta->rta_type == IFLA_IFNAME)
+						break;
+				}
+				if (!RTA_OK(rta, rlen))
+					break;
+
+				i = find_ifname(RTA_DATA(rta));
+				if (i != -1) {
+					if (nh->nlmsg_type == RTM_DELLINK || (unsigned int)ifi->ifi_index != m_link[i].ifindex)
+						relink = 1;
+					changed |= parse_link(NULL, i, nh);
+				} else if (nh->nlmsg_type == RTM_NEWLINK) {
+					/* A new interface to monitor, or one renamed */
+					if (interface_match(RTA_DATA(rta)) || find_ifindex(ifi->ifi_index) != -1)
+						relink = 1;
+				}
+				break;
+
+			case RTM_NEWADDR:
+			case RTM_DELADDR:
+				changed |= parse_addr(nh);
+				break;
+			}
+		}
+	}
+
+	if (relink)
+		return 2;
+	if (!changed)
+		return 0;
+
+	netinfo_clear(netinfo);
+	link_copy(netinfo);
+
+	return 1;
+}
+
+#endif /* CONFIG_ENABLE_NETLINK */
+#endif /* __linux__ */
+
+/* vim: ts=4 sts=4 sw=4 nowrap
+ */
@@ -21,11 +21,17 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stddef.h>		/* offsetof() */
 #include <stdint.h>		/* intptr_t/uintptr_t */
 #include <errno.h>
 #include <time.h>
 
 #include "mini-snmpd.h"
+#ifdef CONFIG_ENABLE_THREADS
+#include <pthread.h>
+#include <signal.h>
+#include <poll.h>
+#endif
 
 /*
  * Module variables
@@ -46,6 +52,7 @@ static const oid_t m_system_oid         = { { 1, 3, 6, 1, 2, 1, 1
 static const oid_t m_if_1_oid           = { { 1, 3, 6, 1, 2, 1, 2               },  7, 8  };
 static const oid_t m_if_2_oid           = { { 1, 3, 6, 1, 2, 1, 2, 2, 1         },  9, 10 };
 static const oid_t m_ip_oid             = { { 1, 3, 6, 1, 2, 1, 4               },  7, 8  };
+static const oid_t m_ipaddr_oid         = { { 1, 3, 6, 1, 2, 1, 4, 20           },  8, 9  };
 static const oid_t m_tcp_oid            = { { 1, 3, 6, 1, 2, 1, 6               },  7, 8  };
 static const oid_t m_udp_oid            = { { 1, 3, 6, 1, 2, 1, 7               },  7, 8  };
 static const oid_t m_host_oid           = { { 1, 3, 6, 1, 2, 1, 25, 1           },  8, 9  };
@@ -54,17 +61,61 @@ static const oid_t m_memory_oid         = { { 1, 3, 6, 1, 4, 1, 2021, 4,
 static const oid_t m_disk_oid           = { { 1, 3, 6, 1, 4, 1, 2021, 9, 1      },  9, 11 };
 static const oid_t m_load_oid           = { { 1, 3, 6, 1, 4, 1, 2021, 10, 1     },  9, 11 };
 static const oid_t m_cpu_oid            = { { 1, 3, 6, 1, 4, 1, 2021, 11        },  8, 10 };
+#ifdef CONFIG_ENABLE_RATES
+static const oid_t m_rates_1_oid        = { { 1, 3, 6, 1, 4, 1, 99999, 3        },  8, 11 };
+static const oid_t m_rates_2_oid        = { { 1, 3, 6, 1, 4, 1, 99999, 3, 4, 1  }, 10, 13 };
+#endif
 #ifdef CONFIG_ENABLE_DEMO
 static const oid_t m_demo_oid           = { { 1, 3, 6, 1, 4, 1, 99999           },  7, 10 };
 #endif
 
 static const int m_load_avg_times[3] = { 1, 5, 15 };
 
+/*
+ * The value buffers of a MIB are allocated from one block, an arena, in
+ * OID order.  So a walk, or a GETBULK, reads memory sequentially, and
+ * freeing the values of a MIB is a single free().  A value outgrowing
+ * its slot in the arena is moved to a buffer of its own on the heap.
+ */
+struct arena {
+	unsigned char *base;
+	size_t         size;
+};
+
+static struct arena m_arena;	/* Values of g_mib */
+
+/* Smallest slot for strings, fits e.g. a MAC address or a load average */
+#define MIN_STRING_SLOT  16
+
+/* Largest varbind sequence header, type and three length bytes */
+#define MAX_VARBIND_HDR  4
+
 static int oid_build  (oid_t *oid, const oid_t *prefix, int column, int row);
 static int encode_oid_len (oid_t *oid);
 
 static int data_alloc (data_t *data, int type);
 static int data_set   (data_t *data, int type, const void *arg);
+static int value_unchanged(const value_t *value, int type, const void *arg);
+static void value_changed (value_t *value, int type, const void *arg);
+static int bytes_unchanged(const data_t *data, const char *str, size_t len);
+static int data_resize(struct arena *arena, data_t *data, size_t len);
+
+static value_t *mib_lookup_update(const oid_t *oid, size_t *pos);
+static void     mib_bind_groups(void);
+static void     mib_bind_slots(void);
+static int      mib_alloc_stats(void);
+static int      mib_alloc_netinfo(void);
+static int      ipaddr_sync(const netinfo_t *netinfo, size_t num);
+static netinfo_t *netinfo_get(void);
+
+static size_t   m_mib_size;	/* Allocated entries of g_mib */
+
+static unsigned long long m_discover_last;
+static unsigned long long m_disk_discover_last;
+static THREAD_LOCAL int   m_in_request;	/* Refreshing a group in lazy mode */
+#ifdef CONFIG_ENABLE_THREADS
+static unsigned int       m_layout;	/* Bumped when entries are added or removed */
+#endif
 
 
 static int encode_integer(data_t *data, int integer_value)
@@ -99,12 +150,8 @@ static int encode_byte_array(data_t *data, const char *string, size_t len)
 	if (!string)
 		return 2;
 
-	if ((len + 4) > data->max_length) {
-		data->max_length = len + 4;
-		data->buffer = realloc(data->buffer, data->max_length);
-		if (!data->buffer)
-			return 2;
-	}
+	if ((len + 4) > data->max_length && data_resize(&m_arena, data, len + 4))
+		return 2;
 
 	if (len > 0xFFFF) {
 		logit(LOG_ERR, 0, "Failed encoding: OCTET STRING overflow");
@@ -222,23 +269,25 @@ static int encode_oid(data_t *data, const oid_t *oid)
 	return 0;
 }
 
+/*
+ * Unsigned types are encoded like an INTEGER, in as few bytes as needed
+ * for a positive value, so with a leading zero byte when the top bit is
+ * set: up to 5 bytes for 32-bit values and 9 bytes for Counter64.
+ */
 static int encode_unsigned(data_t *data, int type, unsigned int ticks_value)
 {
 	unsigned char *buffer;
 	int length;
 
 	buffer = data->buffer;
-	if (ticks_value & 0xFF800000)
-		length = 4;
-	else if (ticks_value & 0x007F8000)
-		length = 3;
-	else if (ticks_value & 0x00007F80)
-		length = 2;
-	else
-		length = 1;
+	length = (ticks_value ? 32 - __builtin_clz(ticks_value) : 0) / 8 + 1;
 
 	*buffer++ = type;
 	*buffer++ = length;
+	if (length > 4) {
+		*buffer++ = 0;
+		length--;
+	}
 	while (length--)
 		*buffer++ = (ticks_value >> (8 * length)) & 0xFF;
 
@@ -247,72 +296,123 @@ static int encode_unsigned(data_t *data, int type, unsigned int ticks_value)
 	return 0;
 }
 
-static int encode_unsigned64(data_t *data, int type, uint64_t ticks_value)
+static int encode_unsigned64(data_t *data, int type, uint64_t value)
 {
 	unsigned char *buffer;
 	int length;
 
 	buffer = data->buffer;
-	if (ticks_value & 0xFF80000000000000ULL)
-		length = 8;
-	else if (ticks_value & 0x007F800000000000ULL)
-		length = 7;
-	else if (ticks_value & 0x00007F8000000000ULL)
-		length = 6;
-	else if (ticks_value & 0x0000007F80000000ULL)
-		length = 5;
-	else if (ticks_value & 0x000000007F800000ULL)
-		length = 4;
-	else if (ticks_value & 0x00000000007F8000ULL)
-		length = 3;
-	else if (ticks_value & 0x0000000000007F80ULL)
-		length = 2;
-	else
-		length = 1;
+	length = (value ? 64 - __builtin_clzll(value) : 0) / 8 + 1;
 
 	*buffer++ = type;
 	*buffer++ = length;
+	if (length > 8) {
+		*buffer++ = 0;
+		length--;
+	}
 	while (length--)
-		*buffer++ = (ticks_value >> (8 * length)) & 0xFF;
+		*buffer++ = (value >> (8 * length)) & 0xFF;
 
 	data->encoded_length = buffer - data->buffer;
 
 	return 0;
 }
 
+/* Make room for at least num entries, the MIB is only ever appended to */
+static int mib_reserve(size_t num)
+{
+	value_t *mib;
+
+	if (num <= m_mib_size)
+		return 0;
+
+	mib = realloc(g_mib, num * sizeof(value_t));
+	if (!mib)
+		return -1;
+
+	g_mib      = mib;
+	m_mib_size = num;
+
+	return 0;
+}
+
+/* Append a new, empty, entry to the MIB table */
+static value_t *mib_append(void)
+{
+	value_t *value;
+
+	if (g_mib_length >= m_mib_size && mib_reserve(2 * m_mib_size + 16))
+		return NULL;
+
+	value = &g_mib[g_mib_length++];
+	memset(value, 0, sizeof(*value));
+
+	return value;
+}
+
+/* Store the subids and the encoding of the OID of a new MIB entry */
+static int mib_oid_set(mib_oid_t *dst, const oid_t *oid)
+{
+	size_t len = oid->subid_list_length * sizeof(oid->subid_list[0]);
+	unsigned char *buf;
+	data_t data;
+
+	buf = allocate(len + oid->encoded_length);
+	if (!buf)
+		return -1;
+
+	memcpy(buf, oid->subid_list, len);
+	data.buffer     = buf + len;
+	data.max_length = oid->encoded_length;
+	if (encode_oid(&data, oid)) {
+		free(buf);
+		return -1;
+	}
+
+	dst->subid_list        = (const unsigned int *)buf;
+	dst->subid_list_length = oid->subid_list_length;
+	dst->encoded           = data.buffer;
+	dst->encoded_length    = data.encoded_length;
+
+	return 0;
+}
+
 static int mib_build_ip_entry(const oid_t *prefix, int type, const void *arg)
 {
 	int ret;
+	oid_t oid;
 	value_t *value;
 	const char *msg = "Failed creating MIB entry";
 	const char *msg2 = "Failed assigning value to OID";
 
 	/* Create a new entry in the MIB table */
-	if (g_mib_length >= MAX_NR_VALUES) {
-		logit(LOG_ERR, 0, "%s '%s': table overflow", msg, oid_ntoa(prefix));
+	value = mib_append();
+	if (!value) {
+		logit(LOG_ERR, errno, "%s '%s'", msg, oid_ntoa(prefix));
 		return -1;
 	}
 
-	value = &g_mib[g_mib_length++];
-	memcpy(&value->oid, prefix, sizeof(value->oid));
+	memcpy(&oid, prefix, sizeof(oid));
 
-	ret  = encode_oid_len(&value->oid);
+	ret  = encode_oid_len(&oid);
+	ret += mib_oid_set(&value->oid, &oid);
 	ret += data_alloc(&value->data, type);
 	if (ret) {
 		logit(LOG_ERR, 0, "%s '%s': unsupported type %d", msg,
-		      oid_ntoa(&value->oid), type);
+		      oid_ntoa(&oid), type);
 		return -1;
 	}
 
 	ret = data_set(&value->data, type, arg);
 	if (ret) {
 		if (ret == 1)
-			logit(LOG_ERR, 0, "%s '%s': unsupported type %d", msg2, oid_ntoa(&value->oid), type);
+			logit(LOG_ERR, 0, "%s '%s': unsupported type %d", msg2, oid_ntoa(&oid), type);
 		else if (ret == 2)
-			logit(LOG_ERR, 0, "%s '%s': invalid default value", msg2, oid_ntoa(&value->oid));
+			logit(LOG_ERR, 0, "%s '%s': invalid default value", msg2, oid_ntoa(&oid));
 
 		return -1;
 	}
+	value_changed(value, type, arg);
 
 	return 0;
 }
@@ -320,54 +420,46 @@ static int mib_build_ip_entry(const oid_t *prefix, int type, const void *arg)
 static value_t *mib_alloc_entry(const oid_t *prefix, int column, int row, int type)
 {
 	int ret;
+	oid_t oid;
 	value_t *value;
 	const char *msg = "Failed creating MIB entry";
 
 	/* Create a new entry in the MIB table */
-	if (g_mib_length >= MAX_NR_VALUES) {
-		logit(LOG_ERR, 0, "%s '%s.%d.%d': table overflow", msg, oid_ntoa(prefix), column, row);
+	value = mib_append();
+	if (!value) {
+		logit(LOG_ERR, errno, "%s '%s.%d.%d'", msg, oid_ntoa(prefix), column, row);
 		return NULL;
 	}
 
-	value = &g_mib[g_mib_length++];
-	memcpy(&value->oid, prefix, sizeof(value->oid));
-
 	/* Create the OID from the prefix, the column and the row */
-	if (oid_build(&value->oid, prefix, column, row)) {
+	if (oid_build(&oid, prefix, column, row)) {
 		logit(LOG_ERR, 0, "%s '%s.%d.%d': oid overflow", msg, oid_ntoa(prefix), column, row);
 		return NULL;
 	}
 
-	ret  = encode_oid_len(&value->oid);
+	ret  = encode_oid_len(&oid);
+	ret += mib_oid_set(&value->oid, &oid);
 	ret += data_alloc(&value->data, type);
 	if (ret) {
 		logit(LOG_ERR, 0, "%s '%s.%d.%d': unsupported type %d", msg,
-		      oid_ntoa(&value->oid), column, row, type);
+		      oid_ntoa(prefix), column, row, type);
 		return NULL;
 	}
 
 	return value;
 }
 
-static int mib_data_set(const oid_t *oid, data_t *data, int column, int row, int type, const void *arg);
+static int mib_data_set(const oid_t *oid, value_t *value, int column, int row, int type, const void *arg);
 
-static int mib_build_entry(const oid_t *prefix, int column, int row, int type, const void *arg)
-{
-	value_t *value;
-
-	value = mib_alloc_entry(prefix, column, row, type);
-	if (!value)
-		return -1;
-
-	return mib_data_set(&value->oid, &value->data, column, row, type, arg);
-}
-
-static int mib_data_set(const oid_t *oid, data_t *data, int column, int row, int type, const void *arg)
+static int mib_data_set(const oid_t *oid, value_t *value, int column, int row, int type, const void *arg)
 {
 	int ret;
 	const char *msg = "Failed assigning value to OID";
 
-	ret = data_set(data, type, arg);
+	if (value_unchanged(value, type, arg))
+		return 0;
+
+	ret = data_set(&value->data, type, arg);
 	if (ret) {
 		if (ret == 1)
 			logit(LOG_ERR, 0, "%s '%s.%d.%d': unsupported type %d", msg, oid_ntoa(oid), column, row, type);
@@ -376,21 +468,26 @@ static int mib_data_set(const oid_t *oid, data_t *data, int column, int row, int
 
 		return -1;
 	}
+	value_changed(value, type, arg);
 
 	return 0;
 }
 
-static int mib_byte_array_set(const oid_t *oid, data_t *data, int column, int row, const void *arg, size_t len)
+static int mib_byte_array_set(const oid_t *oid, value_t *value, int column, int row, const void *arg, size_t len)
 {
 	int ret;
 	const char *msg = "Failed assigning value to OID";
 
-	ret = encode_byte_array(data, arg, len);
+	if (value->generation && bytes_unchanged(&value->data, arg, len))
+		return 0;
+
+	ret = encode_byte_array(&value->data, arg, len);
 	if (ret) {
 		if (ret == 2)
 			logit(LOG_ERR, 0, "%s '%s.%d.%d': invalid default value", msg, oid_ntoa(oid), column, row);
 		return -1;
 	}
+	value_changed(value, BER_TYPE_OCTET_STRING, NULL);
 
 	return 0;
 }
@@ -486,7 +583,7 @@ static int data_alloc(data_t *data, int type)
 		break;
 
 	case BER_TYPE_COUNTER64:
-		data->max_length = sizeof(uint64_t) + 2;
+		data->max_length = sizeof(uint64_t) + 3;
 		data->encoded_length = 0;
 		data->buffer = allocate(data->max_length);
 		break;
@@ -562,912 +659,2209 @@ static int data_set(data_t *data, int type, const void *arg)
 	return 1;
 }
 
-struct in_sort {
-	int pos;
-	unsigned int addr;
-} sorted_interface_list[MAX_NR_INTERFACES];
-
-int in_cmp(const void *p1, const void *p2)
+static int in_arena(const struct arena *arena, const unsigned char *ptr)
 {
-	struct in_sort *a = (struct in_sort *)p1;
-	struct in_sort *b = (struct in_sort *)p2;
+	uintptr_t addr = (uintptr_t)ptr;
+	uintptr_t base = (uintptr_t)arena->base;
 
-	return (int)(a->addr - b->addr);
+	return addr >= base && addr < base + arena->size;
 }
 
-void sort_addr(netinfo_t *netinfo)
+/* Grow the buffer of a value, if it is in the arena it moves to the heap */
+static int data_resize(struct arena *arena, data_t *data, size_t len)
 {
-	size_t i;
+	unsigned char *buf;
 
-	for (i = 0; i < g_interface_list_length; i++) {
-		sorted_interface_list[i].pos  = i;
-		sorted_interface_list[i].addr = netinfo->in_addr[i];
+	if (in_arena(arena, data->buffer)) {
+		buf = malloc(len);
+		if (buf)
+			memcpy(buf, data->buffer, data->max_length);
+	} else {
+		buf = realloc(data->buffer, len);
 	}
+	if (!buf)
+		return -1;
+
+	data->buffer     = buf;
+	data->max_length = len;
 
-	qsort(sorted_interface_list, g_interface_list_length, sizeof(struct in_sort), in_cmp);
+	return 0;
 }
 
-static int build_ip_mib(oid_t *oid, int type, unsigned int in_addr[], unsigned int value[])
+/* Size of the slot in the arena for a value, strings get room to grow */
+static size_t arena_slot(const data_t *data)
 {
-	size_t i;
+	if (data->buffer && data->buffer[0] == BER_TYPE_OCTET_STRING && data->max_length < MIN_STRING_SLOT)
+		return MIN_STRING_SLOT;
 
-	for (i = 0; i < g_interface_list_length; i++) {
-		unsigned int ip;
-		int pos;
-		int j;
+	return data->max_length;
+}
 
-		/* Find position in in_addr[] and value[] */
-		pos = sorted_interface_list[i].pos;
+/*
+ * Size of an entry in the arena, its subids unless shared with another
+ * MIB, and its varbind: room for the header, the encoded OID and the value
+ */
+static size_t arena_entry(const value_t *value, int subids)
+{
+	size_t len = MAX_VARBIND_HDR + value->oid.encoded_length + arena_slot(&value->data);
 
-		if (!in_addr[pos])
-			continue;
+	if (subids)
+		len += value->oid.subid_list_length * sizeof(unsigned int);
 
-		ip = htonl(in_addr[pos]);
-		for (j = 0; j < 4; ++j)
-			oid->subid_list[10 + j] = ((ip & (0xFF << (j * 8))) >> (j * 8));
+	return (len + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+}
 
-		if (mib_build_ip_entry(oid, type, (const void *)(intptr_t)value[pos]) == -1)
-			return -1;
+/* Update the sequence header of the varbind of an entry, after its value */
+static void value_varbind(value_t *value)
+{
+	unsigned char *oid = (unsigned char *)value->oid.encoded;
+	unsigned char *hdr;
+	size_t len;
+
+	value->varbind        = NULL;
+	value->varbind_length = 0;
+
+	/* Moved to the heap, the response must be assembled from the parts */
+	len = value->oid.encoded_length + value->data.encoded_length;
+	if (value->data.buffer != oid + value->oid.encoded_length || len > 0xFFFF)
+		return;
+
+	if (len > 0xFF) {
+		hdr    = oid - 4;
+		hdr[1] = 0x82;
+		hdr[2] = (len >> 8) & 0xFF;
+		hdr[3] = len & 0xFF;
+	} else if (len > 0x7F) {
+		hdr    = oid - 3;
+		hdr[1] = 0x81;
+		hdr[2] = len & 0xFF;
+	} else {
+		hdr    = oid - 2;
+		hdr[1] = len & 0x7F;
 	}
+	hdr[0] = BER_TYPE_SEQUENCE;
 
-	return 0;
+	value->varbind        = hdr;
+	value->varbind_length = oid + len - hdr;
 }
 
-static int build_int(const oid_t *oid, int col, int row, unsigned int val)
+/* The raw value of scalar types, to detect changes without encoding */
+static uint64_t value_raw(int type, const void *arg)
 {
-	return mib_build_entry(oid, col, row, BER_TYPE_INTEGER, (const void *)(intptr_t)val);
+	if (type == BER_TYPE_COUNTER64)
+		return *((const uint64_t *)arg);
+
+	return (uintptr_t)arg;
 }
 
-static int build_str(const oid_t *oid, int col, int row, char *str)
+/* Check if a string is already encoded in a buffer */
+static int bytes_unchanged(const data_t *data, const char *str, size_t len)
 {
-	return mib_build_entry(oid, col, row, BER_TYPE_OCTET_STRING, str);
+	size_t hdr = len > 0xFF ? 4 : len > 0x7F ? 3 : 2;
+
+	if (!str || data->buffer[0] != BER_TYPE_OCTET_STRING || (size_t)data->encoded_length != hdr + len)
+		return 0;
+
+	return !memcmp(data->buffer + hdr, str, len);
 }
 
-static int build_gge(const oid_t *oid, int col, int row, unsigned int val)
+/*
+ * Check if an entry already holds a value, so it need not be re-encoded.
+ * Scalars are compared with the raw value last set, strings with their
+ * encoding, other types are always considered changed.
+ */
+static int value_unchanged(const value_t *value, int type, const void *arg)
 {
-	return mib_build_entry(oid, col, row, BER_TYPE_GAUGE, (const void *)(intptr_t)val);
+	if (!value->generation || value->data.buffer[0] != type)
+		return 0;
+
+	switch (type) {
+	case BER_TYPE_INTEGER:
+	case BER_TYPE_IP_ADDRESS:
+	case BER_TYPE_COUNTER:
+	case BER_TYPE_COUNTER64:
+	case BER_TYPE_GAUGE:
+	case BER_TYPE_TIME_TICKS:
+		return value->raw == value_raw(type, arg);
+
+	case BER_TYPE_OCTET_STRING:
+		return arg && bytes_unchanged(&value->data, arg, strlen(arg));
+
+	default:
+		break;
+	}
+
+	return 0;
 }
 
-static int build_tm(const oid_t *oid, int col, int row, unsigned int tm)
+/* Record a new value of an entry, bump its generation and its varbind */
+static void value_changed(value_t *value, int type, const void *arg)
 {
-	return mib_build_entry(oid, col, row, BER_TYPE_TIME_TICKS, (const void *)(intptr_t)tm);
+	value->raw = 0;
+	if (type != BER_TYPE_OCTET_STRING && type != BER_TYPE_OID && type != BER_TYPE_NULL)
+		value->raw = value_raw(type, arg);
+
+	/* Zero is reserved for entries never set */
+	if (!++value->generation)
+		value->generation = 1;
+
+	value_varbind(value);
 }
 
-static int mib_build_entries(const oid_t *prefix, int column, int row_from, int row_to, int type)
+/*
+ * Move the subids, unless shared with another MIB, and the varbinds of a
+ * MIB to a new arena, in OID order, values without a buffer get an empty
+ * one.  The previous arena, and everything moved out of it, is freed.
+ */
+static int arena_pack(struct arena *arena, value_t *mib, size_t length, int subids)
 {
-	int row;
+	unsigned char *base, *ptr;
+	size_t i, size = 0;
 
-	for (row = row_from; row <= row_to; row++) {
-		if (!mib_alloc_entry(prefix, column, row, type))
-			return -1;
+	for (i = 0; i < length; i++)
+		size += arena_entry(&mib[i], subids);
+
+	base = calloc(1, size + 1);
+	if (!base)
+		return -1;
+
+	for (ptr = base, i = 0; i < length; i++) {
+		unsigned char *end = ptr + arena_entry(&mib[i], subids);
+		const void *block = mib[i].oid.subid_list;
+		mib_oid_t *oid = &mib[i].oid;
+		data_t *data = &mib[i].data;
+
+		if (subids) {
+			size_t len = oid->subid_list_length * sizeof(unsigned int);
+
+			memcpy(ptr, oid->subid_list, len);
+			oid->subid_list = (const unsigned int *)ptr;
+			ptr += len;
+		}
+
+		ptr += MAX_VARBIND_HDR;
+		memcpy(ptr, oid->encoded, oid->encoded_length);
+		oid->encoded = ptr;
+		ptr += oid->encoded_length;
+
+		/*
+		 * The OID of a new entry is allocated in one block with its
+		 * subids, those of a snapshot are in the arena of g_mib
+		 */
+		if (subids && !in_arena(arena, block) && !in_arena(&m_arena, block))
+			free((void *)block);
+
+		if (data->buffer) {
+			memcpy(ptr, data->buffer, data->max_length);
+			if (!in_arena(arena, data->buffer))
+				free(data->buffer);
+		}
+
+		data->buffer     = ptr;
+		data->max_length = end - ptr;
+		ptr = end;
+
+		value_varbind(&mib[i]);
 	}
 
+	free(arena->base);
+	arena->base = base;
+	arena->size = size;
+
 	return 0;
 }
 
-static value_t *mib_value_find(const oid_t *prefix, int column, int row, size_t *pos)
+/*
+ * The ifTable and ifXTable groups share the interface statistics, and the
+ * IP, TCP and UDP groups share the protocol statistics.  Each is fetched
+ * at most once per update, see cache_flush().
+ */
+static netinfo_t   m_netinfo;
+static int         m_netinfo_valid;
+static protoinfo_t m_protoinfo;
+static int         m_protoinfo_valid;
+
+static netinfo_t   m_linkinfo;		/* Link changes, see mib_link_event() */
+static diskinfo_t  m_diskinfo;
+static meminfo_t   m_meminfo;
+static loadinfo_t  m_loadinfo;
+static cpuinfo_t   m_cpuinfo;
+#ifdef CONFIG_ENABLE_RATES
+static rateinfo_t  m_rateinfo;
+#endif
+#ifdef CONFIG_ENABLE_DEMO
+static demoinfo_t  m_demoinfo;
+#endif
+
+/* The index of each row in the MIB of a table whose rows come and go */
+struct mib_rows {
+	unsigned int *key;
+	size_t        length;
+};
+
+static struct mib_rows m_if_rows;
+static struct mib_rows m_disk_rows;
+
+/* The rows of the ipAddrTable, see update_ipaddr() */
+#define IPADDR_COLUMNS 4
+
+struct ipaddr {
+	unsigned int addr;
+	size_t       pos;		/* Of the interface in g_interface_list */
+};
+
+static struct ipaddr  *m_ipaddr;	/* Addresses of the interfaces */
+static struct mib_rows m_ipaddr_rows;
+static int             m_ipaddr_stale;	/* Rows to add or remove */
+
+/* Size the interface statistics from the number of interfaces monitored */
+static int mib_alloc_netinfo(void)
 {
-	oid_t oid;
-	value_t *value;
-	const char *msg = "Failed updating OID";
+	struct ipaddr *ipaddr;
 
-	memcpy(&oid, prefix, sizeof(oid));
+	if (netinfo_alloc(&m_netinfo, g_interface_list_length) ||
+	    netinfo_alloc(&m_linkinfo, g_interface_list_length))
+		return -1;
+#ifdef CONFIG_ENABLE_RATES
+	if (rateinfo_alloc(&m_rateinfo, g_interface_list_length))
+		return -1;
+#endif
 
-	/* Create the OID from the prefix, the column and the row */
-	if (oid_build(&oid, prefix, column, row)) {
-		logit(LOG_ERR, 0, "%s '%s.%d.%d': OID overflow", msg, oid_ntoa(prefix), column, row);
-		return NULL;
-	}
+	ipaddr = realloc(m_ipaddr, (g_interface_list_length + 1) * sizeof(*ipaddr));
+	if (!ipaddr)
+		return -1;
+	m_ipaddr = ipaddr;
 
-	/* Search the MIB for the given OID beginning at the given position */
-	value = mib_find(&oid, pos);
-	if (!value)
-		logit(LOG_ERR, 0, "%s '%s.%d.%d': OID not found", msg, oid_ntoa(prefix), column, row);
+	m_netinfo_valid = 0;
 
-	return value;
+	return 0;
 }
 
-static int mib_update_entry(const oid_t *prefix, int column, int row, size_t *pos, int type, const void *arg)
+/* Size the statistics from the number of interfaces and disks monitored */
+static int mib_alloc_stats(void)
 {
-	value_t *value;
-
-	value = mib_value_find(prefix, column, row, pos);
-	if (!value)
+	if (mib_alloc_netinfo() || diskinfo_alloc(&m_diskinfo, g_disk_list_length))
 		return -1;
 
-	return mib_data_set(prefix, &value->data, column, row, type, arg);
+	return 0;
 }
 
-static int mib_update_byte_array(const oid_t *prefix, int column, int row, size_t *pos, const void *arg, size_t len)
+static netinfo_t *netinfo_get(void)
 {
-	value_t *value;
+	if (!m_netinfo_valid) {
+		get_netinfo(&m_netinfo);
+		netinfo_track(&m_netinfo);
+		m_netinfo_valid = 1;
+	}
 
-	value = mib_value_find(prefix, column, row, pos);
-	if (!value)
-		return -1;
+	return &m_netinfo;
+}
+
+static protoinfo_t *protoinfo_get(void)
+{
+	if (!m_protoinfo_valid) {
+		get_protoinfo(&m_protoinfo);
+		udpinfo_track(&m_protoinfo.udp);
+		m_protoinfo_valid = 1;
+	}
 
-	return mib_byte_array_set(prefix, &value->data, column, row, arg, len);
+	return &m_protoinfo;
 }
 
-static int update_int(const oid_t *oid, int col, int row, size_t *pos, unsigned int val)
+static void cache_flush(void)
 {
-	return mib_update_entry(oid, col, row, pos, BER_TYPE_INTEGER, (const void *)(intptr_t)val);
+	m_netinfo_valid   = 0;
+	m_protoinfo_valid = 0;
 }
 
-static int update_str(const oid_t *oid, int col, int row, size_t *pos, char *str)
+/*
+ * The statistics of each group, read when it is refreshed and passed to
+ * the getters of its columns
+ */
+static const void *group_netinfo(void)
 {
-	return mib_update_entry(oid, col, row, pos, BER_TYPE_OCTET_STRING, str);
+	return netinfo_get();
 }
 
-static int update_gge(const oid_t *oid, int col, int row, size_t *pos, unsigned int val)
+static const void *group_protoinfo(void)
 {
-	return mib_update_entry(oid, col, row, pos, BER_TYPE_GAUGE, (const void *)(intptr_t)val);
+	return protoinfo_get();
 }
 
-static int update_tm(const oid_t *oid, int col, int row, size_t *pos, unsigned int tm)
+static const void *group_meminfo(void)
 {
-	return mib_update_entry(oid, col, row, pos, BER_TYPE_TIME_TICKS, (const void *)(intptr_t)tm);
+	get_meminfo(&m_meminfo);
+	return &m_meminfo;
 }
 
-static int update_cnt(const oid_t *oid, int col, int row, size_t *pos, unsigned int cnt)
+static const void *group_diskinfo(void)
 {
-	return mib_update_entry(oid, col, row, pos, BER_TYPE_COUNTER, (const void *)(intptr_t)cnt);
+	get_diskinfo(&m_diskinfo);
+	return &m_diskinfo;
 }
 
-static int update_c64(const oid_t *oid, int col, int row, size_t *pos, long long cnt)
+static const void *group_loadinfo(void)
 {
-	return mib_update_entry(oid, col, row, pos, BER_TYPE_COUNTER64, (const void *)&cnt);
+	get_loadinfo(&m_loadinfo);
+	return &m_loadinfo;
 }
 
-/* -----------------------------------------------------------------------------
- * Interface functions
- *
- * To extend the MIB, add the relevant mib_build_entry() calls (to add one MIB
- * variable) or mib_build_entries() calls (to add a column of a MIB table) in
- * the mib_build() function. Note that building the MIB must be done strictly in
- * ascending OID order or the SNMP getnext/getbulk functions will not work as
- * expected!
- *
- * To extend the MIB, add the relevant mib_update_entry() calls (to update one
- * MIB variable or one cell in a MIB table) in the mib_update() function. Note
- * that the MIB variables must be added in the correct order (i.e. ascending).
- * How to get the value for that variable is up to you, but bear in mind that
- * the mib_update() function is called between receiving the request from the
- * client and sending back the response; thus you should avoid time-consuming
- * actions!
- *
- * The variable types supported up to now are OCTET_STRING, INTEGER (32 bit
- * signed), COUNTER (32 bit unsigned), TIME_TICKS (32 bit unsigned, in 1/10s)
- * and OID.
- *
- * Note that the maximum number of MIB variables is restricted by the length of
- * the MIB array, (see mini-snmpd.h for the value of MAX_NR_VALUES).
- */
+static const void *group_cpuinfo(void)
+{
+	get_cpuinfo(&m_cpuinfo);
+	return &m_cpuinfo;
+}
 
-int mib_build(void)
+#ifdef CONFIG_ENABLE_RATES
+static const void *group_rateinfo(void)
 {
-	netinfo_t netinfo;
-	char hostname[MAX_STRING_SIZE];
-	char name[16];
-	size_t i;
-	int sysServices;
+	get_rateinfo(&m_rateinfo, netinfo_get(), mib_ticks());
+	return &m_rateinfo;
+}
+#endif
 
-	sysServices = ((1 << 0) +	/* Physical layer */
-		       (1 << 1) +	/* L2 Datalink layer */
-		       (1 << 2) +	/* L3 IP Layer */
-		       (1 << 3) +	/* L4 TCP/UDP Layer */
-		       (1 << 6));	/* Applications layer */
+#ifdef CONFIG_ENABLE_DEMO
+static const void *group_demoinfo(void)
+{
+	get_demoinfo(&m_demoinfo);
+	return &m_demoinfo;
+}
+#endif
 
-	/* Determine some static values that are not known at compile-time */
-	if (gethostname(hostname, sizeof(hostname)) == -1)
-		hostname[0] = '\0';
-	else
-		hostname[sizeof(hostname) - 1] = '\0';
+/* The OID of a cell of the ipAddrTable, indexed by the address */
+static void ipaddr_oid(oid_t *oid, int column, unsigned int addr)
+{
+	const oid_t entry = { { 1, 3, 6, 1, 2, 1, 4, 20, 1, 0, 0, 0, 0, 0 }, 14, 15 };
+	int j;
 
-	get_netinfo(&netinfo);
+	*oid = entry;
+	oid->subid_list[9] = column;
+	for (j = 0; j < 4; j++)
+		oid->subid_list[10 + j] = (addr >> (24 - 8 * j)) & 0xFF;
+}
 
-	/*
-	 * The system MIB: basic info about the host (SNMPv2-MIB.txt)
-	 * Caution: on changes, adapt the corresponding mib_update() section too!
-	 */
-	if (mib_build_entry(&m_system_oid, 1, 0, BER_TYPE_OCTET_STRING, g_description) == -1 ||
-	    mib_build_entry(&m_system_oid, 2, 0, BER_TYPE_OID,          g_vendor)      == -1 ||
-	    !mib_alloc_entry(&m_system_oid, 3, 0, BER_TYPE_TIME_TICKS)                        ||
-	    mib_build_entry(&m_system_oid, 4, 0, BER_TYPE_OCTET_STRING, g_contact)     == -1 ||
-	    mib_build_entry(&m_system_oid, 5, 0, BER_TYPE_OCTET_STRING, hostname)      == -1 ||
-	    mib_build_entry(&m_system_oid, 6, 0, BER_TYPE_OCTET_STRING, g_location)    == -1 ||
-	    mib_build_entry(&m_system_oid, 7, 0, BER_TYPE_INTEGER, (const void *)(intptr_t)sysServices) == -1)
-		return -1;
+/* The type and value of a cell of the ipAddrTable, of interface i */
+static int ipaddr_cell(const netinfo_t *netinfo, size_t i, int column, const void **arg)
+{
+	switch (column) {
+	case 1:
+		*arg = (const void *)(intptr_t)netinfo->in_addr[i];
+		return BER_TYPE_IP_ADDRESS;
 
-	/*
-	 * The interface MIB: network interfaces (IF-MIB.txt)
-	 * Caution: on changes, adapt the corresponding mib_update() section too!
-	 */
-	if (g_interface_list_length > 0) {
-		if (build_int(&m_if_1_oid, 1, 0, g_interface_list_length) == -1)
-			return -1;
+	case 2:
+		*arg = (const void *)(intptr_t)netinfo->ifindex[i];
+		return BER_TYPE_INTEGER;
 
-		/* ifIndex */
-		for (i = 0; i < g_interface_list_length; i++) {
-			if (build_int(&m_if_2_oid, 1, i + 1, netinfo.ifindex[i]) == -1)
-				return -1;
-		}
+	case 3:
+		*arg = (const void *)(intptr_t)netinfo->in_mask[i];
+		return BER_TYPE_IP_ADDRESS;
 
-		/* ifDescription */
-		for (i = 0; i < g_interface_list_length; i++) {
-			if (build_str(&m_if_2_oid, 2, i + 1, g_interface_list[i]) == -1)
-				return -1;
-		}
+	default:
+		break;
+	}
 
-		/* ifType: ENUM, ethernetCsmacd(6) <-- recommended for all types of Ethernets */
-		for (i = 0; i < g_interface_list_length; i++) {
-			if (build_int(&m_if_2_oid, 3, i + 1, 6) == -1)
-				return -1;
-		}
+	*arg = (const void *)(intptr_t)netinfo->in_bcent[i];
+	return BER_TYPE_INTEGER;
+}
 
-		/* ifMtu */
-		for (i = 0; i < g_interface_list_length; i++) {
-			if (build_int(&m_if_2_oid, 4, i + 1, 1500) == -1)
-				return -1;
-		}
+static int ipaddr_cmp(const void *p1, const void *p2)
+{
+	const struct ipaddr *a = p1;
+	const struct ipaddr *b = p2;
 
-		/* ifSpeed (in bps) */
-		for (i = 0; i < g_interface_list_length; i++) {
-			if (build_gge(&m_if_2_oid, 5, i + 1, 1000000000) == -1)
-				return -1;
-		}
+	if (a->addr != b->addr)
+		return a->addr < b->addr ? -1 : 1;
 
-		/* ifPhysAddress */
-		for (i = 1; i <= g_interface_list_length; i++) {
-			if (build_str(&m_if_2_oid, 6, i, "") == -1)
-				return -1;
-		}
+	if (a->pos < b->pos)
+		return -1;
 
-		/* ifAdminStatus: up(1), down(2), testing(3) */
-		for (i = 0; i < g_interface_list_length; i++) {
-			if (build_int(&m_if_2_oid, 7, i + 1, 1) == -1)
-				return -1;
-		}
+	return a->pos > b->pos;
+}
 
-		/* ifOperStatus: up(1), down(2), testing(3), unknown(4), dormant(5), notPresent(6), lowerLayerDown(7) */
-		for (i = 0; i < g_interface_list_length; i++) {
-			if (build_int(&m_if_2_oid, 8, i + 1, 1) == -1)
-				return -1;
-		}
+/*
+ * The addresses of the interfaces, ascending like the rows of the
+ * ipAddrTable, in m_ipaddr.  An address on several interfaces is given
+ * to the first, by ifIndex.  Returns the number of addresses.
+ */
+static size_t ipaddr_list(const netinfo_t *netinfo)
+{
+	size_t i, num = 0;
 
-		/* ifLastChange */
-		for (i = 0; i < g_interface_list_length; i++) {
-			if (build_tm(&m_if_2_oid, 9, i + 1, 0) == -1)
-				return -1;
-		}
+	for (i = 0; i < g_interface_list_length; i++) {
+		if (!netinfo->in_addr[i])
+			continue;
 
-		if (mib_build_entries(&m_if_2_oid, 10, 1, g_interface_list_length, BER_TYPE_COUNTER) == -1 ||
-		    mib_build_entries(&m_if_2_oid, 11, 1, g_interface_list_length, BER_TYPE_COUNTER) == -1 ||
-		    mib_build_entries(&m_if_2_oid, 13, 1, g_interface_list_length, BER_TYPE_COUNTER) == -1 ||
-		    mib_build_entries(&m_if_2_oid, 14, 1, g_interface_list_length, BER_TYPE_COUNTER) == -1 ||
-		    mib_build_entries(&m_if_2_oid, 16, 1, g_interface_list_length, BER_TYPE_COUNTER) == -1 ||
-		    mib_build_entries(&m_if_2_oid, 17, 1, g_interface_list_length, BER_TYPE_COUNTER) == -1 ||
-		    mib_build_entries(&m_if_2_oid, 19, 1, g_interface_list_length, BER_TYPE_COUNTER) == -1 ||
-		    mib_build_entries(&m_if_2_oid, 20, 1, g_interface_list_length, BER_TYPE_COUNTER) == -1)
-			return -1;
+		m_ipaddr[num].addr  = netinfo->in_addr[i];
+		m_ipaddr[num++].pos = i;
 	}
 
-	/*
-	 * The IP-MIB.
-	 */
-	if (!mib_alloc_entry(&m_ip_oid,  1, 0, BER_TYPE_INTEGER) ||
-	    !mib_alloc_entry(&m_ip_oid,  2, 0, BER_TYPE_INTEGER) ||
-	    !mib_alloc_entry(&m_ip_oid, 13, 0, BER_TYPE_INTEGER) )
-		return -1;
+	qsort(m_ipaddr, num, sizeof(*m_ipaddr), ipaddr_cmp);
+	for (i = 1; i < num; i++) {
+		if (m_ipaddr[i].addr != m_ipaddr[i - 1].addr)
+			continue;
 
-	{
-		oid_t m_ip_adentryaddr_oid   = { { 1, 3, 6, 1, 2, 1, 4, 20, 1, 1, 0, 0, 0, 0 },  14, 15  };
-		oid_t m_ip_adentryifidx_oid  = { { 1, 3, 6, 1, 2, 1, 4, 20, 1, 2, 0, 0, 0, 0 },  14, 15  };
-		oid_t m_ip_adentrymask_oid   = { { 1, 3, 6, 1, 2, 1, 4, 20, 1, 3, 0, 0, 0, 0 },  14, 15  };
-		oid_t m_ip_adentrybcaddr_oid = { { 1, 3, 6, 1, 2, 1, 4, 20, 1, 4, 0, 0, 0, 0 },  14, 15  };
+		memmove(&m_ipaddr[i], &m_ipaddr[i + 1], (num - i - 1) * sizeof(*m_ipaddr));
+		num--;
+		i--;
+	}
 
-		sort_addr(&netinfo);
+	return num;
+}
 
-		build_ip_mib(&m_ip_adentryaddr_oid,   BER_TYPE_IP_ADDRESS, netinfo.in_addr, netinfo.in_addr);
-		build_ip_mib(&m_ip_adentryifidx_oid,  BER_TYPE_INTEGER,    netinfo.in_addr, netinfo.ifindex);
-		build_ip_mib(&m_ip_adentrymask_oid,   BER_TYPE_IP_ADDRESS, netinfo.in_addr, netinfo.in_mask);
-		build_ip_mib(&m_ip_adentrybcaddr_oid, BER_TYPE_INTEGER,    netinfo.in_addr, netinfo.in_bcent);
-	}
+/* Check if the addresses listed differ from the rows in the MIB */
+static int ipaddr_changed(size_t num)
+{
+	size_t i;
 
-	/*
-	 * The TCP-MIB.
-	 */
-	if (!mib_alloc_entry(&m_tcp_oid,  1, 0, BER_TYPE_INTEGER) ||
-	    !mib_alloc_entry(&m_tcp_oid,  2, 0, BER_TYPE_INTEGER) ||
-	    !mib_alloc_entry(&m_tcp_oid,  3, 0, BER_TYPE_INTEGER) ||
-	    !mib_alloc_entry(&m_tcp_oid,  4, 0, BER_TYPE_INTEGER) ||
-	    !mib_alloc_entry(&m_tcp_oid,  5, 0, BER_TYPE_COUNTER) ||
-	    !mib_alloc_entry(&m_tcp_oid,  6, 0, BER_TYPE_COUNTER) ||
-	    !mib_alloc_entry(&m_tcp_oid,  7, 0, BER_TYPE_COUNTER) ||
-	    !mib_alloc_entry(&m_tcp_oid,  8, 0, BER_TYPE_COUNTER) ||
-	    !mib_alloc_entry(&m_tcp_oid,  9, 0, BER_TYPE_GAUGE)   ||
-	    !mib_alloc_entry(&m_tcp_oid, 10, 0, BER_TYPE_COUNTER) ||
-	    !mib_alloc_entry(&m_tcp_oid, 11, 0, BER_TYPE_COUNTER) ||
-	    !mib_alloc_entry(&m_tcp_oid, 12, 0, BER_TYPE_COUNTER) ||
-	    !mib_alloc_entry(&m_tcp_oid, 14, 0, BER_TYPE_COUNTER) ||
-	    !mib_alloc_entry(&m_tcp_oid, 15, 0, BER_TYPE_COUNTER))
-		return -1;
+	if (num != m_ipaddr_rows.length)
+		return 1;
 
-	/*
-	 * The UDP-MIB.
-	 */
-	if (!mib_alloc_entry(&m_udp_oid,  1, 0, BER_TYPE_COUNTER)   ||
-	    !mib_alloc_entry(&m_udp_oid,  2, 0, BER_TYPE_COUNTER)   ||
-	    !mib_alloc_entry(&m_udp_oid,  3, 0, BER_TYPE_COUNTER)   ||
-	    !mib_alloc_entry(&m_udp_oid,  4, 0, BER_TYPE_COUNTER)   ||
-	    !mib_alloc_entry(&m_udp_oid,  8, 0, BER_TYPE_COUNTER64) ||
-	    !mib_alloc_entry(&m_udp_oid,  9, 0, BER_TYPE_COUNTER64)) {
-		return -1;
+	for (i = 0; i < num; i++) {
+		if (m_ipaddr[i].addr != m_ipaddr_rows.key[i])
+			return 1;
 	}
 
+	return 0;
+}
+
+/*
+ * Rows of the ipAddrTable are indexed by the address, so they are added
+ * and removed as the addresses of the interfaces change, see ipaddr_sync().
+ * While a request is served, in lazy mode, only the rows already in the
+ * MIB are updated, the others are left to the next mib_discover().
+ */
+static int update_ipaddr(const void *src)
+{
+	const netinfo_t *netinfo = src;
+	size_t i, num;
+	int column;
+
+	num = ipaddr_list(netinfo);
+	if (ipaddr_changed(num)) {
+		if (m_in_request)
+			m_ipaddr_stale = 1;
+		else if (ipaddr_sync(netinfo, num))
+			return -1;
+	}
+
+	for (i = 0; i < num; i++) {
+		for (column = 1; column <= IPADDR_COLUMNS; column++) {
+			const void *arg;
+			value_t *value;
+			size_t pos = 0;
+			oid_t oid;
+			int type;
+
+			ipaddr_oid(&oid, column, m_ipaddr[i].addr);
+			value = mib_lookup_update(&oid, &pos);
+			if (!value)
+				continue;
+
+			type = ipaddr_cell(netinfo, m_ipaddr[i].pos, column, &arg);
+			if (value_unchanged(value, type, arg))
+				continue;
+
+			if (data_set(&value->data, type, arg))
+				return -1;
+			value_changed(value, type, arg);
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * A cell of a MIB column as read by the getter of the column, for row i
+ * (counting from 0) from the statistics src of its group.  Strings that
+ * are not NUL terminated also set the length.
+ */
+struct mib_cell {
+	long long   num;
+	counter_t   count;		/* Of Counter64 columns */
+	const char *str;
+	size_t      len;
+	char        buf[MAX_STRING_SIZE];
+};
+
+struct mib_column;
+typedef void (*mib_get_t)(const struct mib_column *col, const void *src, size_t i, struct mib_cell *cell);
+
+#define FIELD(src, col) ((const char *)(src) + (col)->field)
+
+static int column_row(const struct mib_column *col, size_t i);
+
+/*
+ * Describes a column of a MIB table, or a scalar, from which mib_build()
+ * creates its entries and mib_update() refreshes them.  The getter reads
+ * each cell from a field in the statistics of the group, a global or a
+ * constant.  Columns are refreshed with their group, the refresh class,
+ * COL_STATIC columns are only set when the MIB is built.
+ */
+struct mib_column {
+	const oid_t *oid;
+	int          column;
+	int          type;
+	int          rows;
+	int          group;
+	int          flags;
+	mib_get_t    get;
+	size_t       field;		/* Offset in the statistics of the group */
+	const void  *ptr;		/* Or a global */
+	long long    arg;		/* Or a constant */
+};
+
+#define COL_STATIC   1		/* Only set when the MIB is built */
+#define COL_LINK     2		/* Also set on link changes, see mib_link_event() */
+
+/* The rows of a column, one for scalars */
+enum { ROWS_SCALAR, ROWS_INTERFACES, ROWS_DISKS, ROWS_LOAD };
+
+/* Index of each group in m_group[] */
+enum {
+	GROUP_SYSTEM,
+	GROUP_INTERFACES,
+	GROUP_IP,
+	GROUP_IPADDR,
+	GROUP_TCP,
+	GROUP_UDP,
+	GROUP_HOST,
+	GROUP_IFXTABLE,
+	GROUP_MEMORY,
+	GROUP_DISK,
+	GROUP_LOAD,
+	GROUP_CPU,
+#ifdef CONFIG_ENABLE_RATES
+	GROUP_RATES,
+#endif
+#ifdef CONFIG_ENABLE_DEMO
+	GROUP_DEMO,
+#endif
+};
+
+#define STATS(type, member)  offsetof(type, member), NULL, 0
+#define GLOBAL(var)          0, &(var), 0
+#define CONST(val)           0, NULL, (val)
+#define NONE                 0, NULL, 0
+
+/* Physical, datalink, IP, TCP/UDP and application layers */
+#define SYS_SERVICES  ((1 << 0) + (1 << 1) + (1 << 2) + (1 << 3) + (1 << 6))
+
+static void get_const(const struct mib_column *col, const void *UNUSED(src), size_t UNUSED(i), struct mib_cell *cell)
+{
+	cell->num = col->arg;
+}
+
+/* The index column of a table */
+static void get_row(const struct mib_column *col, const void *UNUSED(src), size_t i, struct mib_cell *cell)
+{
+	cell->num = column_row(col, i);
+}
+
+static void get_count(const struct mib_column *col, const void *UNUSED(src), size_t UNUSED(i), struct mib_cell *cell)
+{
+	cell->num = *(const size_t *)col->ptr;
+}
+
+static void get_string(const struct mib_column *col, const void *UNUSED(src), size_t UNUSED(i), struct mib_cell *cell)
+{
+	cell->str = *(char *const *)col->ptr;
+}
+
+/* An element of a list from the configuration, e.g. the interface names */
+static void get_list(const struct mib_column *col, const void *UNUSED(src), size_t i, struct mib_cell *cell)
+{
+	cell->str = (*(char **const *)col->ptr)[i];
+}
+
+static void get_hostname(const struct mib_column *UNUSED(col), const void *UNUSED(src), size_t UNUSED(i), struct mib_cell *cell)
+{
+	if (gethostname(cell->buf, sizeof(cell->buf)) == -1)
+		cell->buf[0] = '\0';
+	else
+		cell->buf[sizeof(cell->buf) - 1] = '\0';
+
+	cell->str = cell->buf;
+}
+
+static void get_uptime(const struct mib_column *UNUSED(col), const void *UNUSED(src), size_t UNUSED(i), struct mib_cell *cell)
+{
+	cell->num = get_process_uptime();
+}
+
+static void get_host_uptime(const struct mib_column *UNUSED(col), const void *UNUSED(src), size_t UNUSED(i), struct mib_cell *cell)
+{
+	cell->num = get_system_uptime();
+}
+
+/* A scalar long long in the statistics */
+static void get_llong(const struct mib_column *col, const void *src, size_t UNUSED(i), struct mib_cell *cell)
+{
+	cell->num = *(const long long *)FIELD(src, col);
+}
+
+/* An unsigned int, or an element of an array of them, in the statistics */
+static void get_uint(const struct mib_column *col, const void *src, size_t i, struct mib_cell *cell)
+{
+	cell->num = ((const unsigned int *)FIELD(src, col))[i];
+}
+
+/* An element of a column of the disk or interface statistics */
+static void get_uint_column(const struct mib_column *col, const void *src, size_t i, struct mib_cell *cell)
+{
+	cell->num = (*(unsigned int *const *)FIELD(src, col))[i];
+}
+
+/* Counter32 columns of a counter get its lower 32 bits, which wrap alike */
+static void cell_counter(struct mib_cell *cell, counter_t count)
+{
+	cell->count = count;
+	cell->num   = (unsigned int)count;
+}
+
+/* A scalar counter in the statistics */
+static void get_counter(const struct mib_column *col, const void *src, size_t UNUSED(i), struct mib_cell *cell)
+{
+	cell_counter(cell, *(const counter_t *)FIELD(src, col));
+}
+
+/* An element of a column of counters of the interface statistics */
+static void get_counter_column(const struct mib_column *col, const void *src, size_t i, struct mib_cell *cell)
+{
+	cell_counter(cell, (*(counter_t *const *)FIELD(src, col))[i]);
+}
+
+static void get_mac(const struct mib_column *UNUSED(col), const void *src, size_t i, struct mib_cell *cell)
+{
+	const netinfo_t *netinfo = src;
+
+	cell->str = netinfo->mac_addr[i];
+	cell->len = sizeof(netinfo->mac_addr[i]);
+}
+
+/* ifAdminStatus, up(1) unless the interface is down(2) */
+static void get_admin(const struct mib_column *UNUSED(col), const void *src, size_t i, struct mib_cell *cell)
+{
+	const netinfo_t *netinfo = src;
+
+	cell->num = netinfo->status[i] != 2 ? 1 : 2;
+}
+
+/* ifHighSpeed, in Mbps */
+static void get_high_speed(const struct mib_column *UNUSED(col), const void *src, size_t i, struct mib_cell *cell)
+{
+	const netinfo_t *netinfo = src;
+
+	cell->num = netinfo->if_speed[i] / 1000000;
+}
+
+#ifdef CONFIG_ENABLE_RATES
+/* A rate of an interface, its window and counter given by the constant */
+static void get_rate(const struct mib_column *col, const void *src, size_t i, struct mib_cell *cell)
+{
+	const rateinfo_t *rateinfo = src;
+
+	cell_counter(cell, rateinfo->rate[i][col->arg]);
+}
+#endif
+
+static void get_load_name(const struct mib_column *UNUSED(col), const void *UNUSED(src), size_t i, struct mib_cell *cell)
+{
+	snprintf(cell->buf, sizeof(cell->buf), "Load-%d", m_load_avg_times[i]);
+	cell->str = cell->buf;
+}
+
+static void get_load_time(const struct mib_column *UNUSED(col), const void *UNUSED(src), size_t i, struct mib_cell *cell)
+{
+	snprintf(cell->buf, sizeof(cell->buf), "%d", m_load_avg_times[i]);
+	cell->str = cell->buf;
+}
+
+static void get_load_avg(const struct mib_column *UNUSED(col), const void *src, size_t i, struct mib_cell *cell)
+{
+	const loadinfo_t *loadinfo = src;
+
+	snprintf(cell->buf, sizeof(cell->buf), "%d.%02d", loadinfo->avg[i] / 100, loadinfo->avg[i] % 100);
+	cell->str = cell->buf;
+}
+
+/*
+ * The MIB.  Adding a variable, or a column of a table, is adding a line
+ * here, and a getter if none of the existing ones fit.  Entries can be
+ * listed in any order, mib_build() sorts the MIB, but keep them in OID
+ * order for readability.
+ */
+static const struct mib_column m_column[] = {
+	/* The system MIB: basic info about the host (SNMPv2-MIB.txt) */
+	{ &m_system_oid,    1, BER_TYPE_OCTET_STRING, ROWS_SCALAR,     GROUP_SYSTEM,     COL_STATIC, get_string,         GLOBAL(g_description) },
+	{ &m_system_oid,    2, BER_TYPE_OID,          ROWS_SCALAR,     GROUP_SYSTEM,     COL_STATIC, get_string,         GLOBAL(g_vendor) },
+	{ &m_system_oid,    3, BER_TYPE_TIME_TICKS,   ROWS_SCALAR,     GROUP_SYSTEM,     0,          get_uptime,         NONE },
+	{ &m_system_oid,    4, BER_TYPE_OCTET_STRING, ROWS_SCALAR,     GROUP_SYSTEM,     COL_STATIC, get_string,         GLOBAL(g_contact) },
+	{ &m_system_oid,    5, BER_TYPE_OCTET_STRING, ROWS_SCALAR,     GROUP_SYSTEM,     COL_STATIC, get_hostname,       NONE },
+	{ &m_system_oid,    6, BER_TYPE_OCTET_STRING, ROWS_SCALAR,     GROUP_SYSTEM,     COL_STATIC, get_string,         GLOBAL(g_location) },
+	{ &m_system_oid,    7, BER_TYPE_INTEGER,      ROWS_SCALAR,     GROUP_SYSTEM,     COL_STATIC, get_const,          CONST(SYS_SERVICES) },
+
+	/* The interface MIB: network interfaces (IF-MIB.txt) */
+	{ &m_if_1_oid,      1, BER_TYPE_INTEGER,      ROWS_SCALAR,     GROUP_INTERFACES, 0,          get_count,          GLOBAL(g_interface_list_length) },
+	{ &m_if_2_oid,      1, BER_TYPE_INTEGER,      ROWS_INTERFACES, GROUP_INTERFACES, COL_STATIC, get_row,            NONE },
+	{ &m_if_2_oid,      2, BER_TYPE_OCTET_STRING, ROWS_INTERFACES, GROUP_INTERFACES, COL_STATIC, get_list,           GLOBAL(g_interface_list) },
+	{ &m_if_2_oid,      3, BER_TYPE_INTEGER,      ROWS_INTERFACES, GROUP_INTERFACES, 0,          get_uint_column,    STATS(netinfo_t, if_type) },
+	{ &m_if_2_oid,      4, BER_TYPE_INTEGER,      ROWS_INTERFACES, GROUP_INTERFACES, 0,          get_uint_column,    STATS(netinfo_t, if_mtu) },
+	{ &m_if_2_oid,      5, BER_TYPE_GAUGE,        ROWS_INTERFACES, GROUP_INTERFACES, 0,          get_uint_column,    STATS(netinfo_t, if_speed) },
+	{ &m_if_2_oid,      6, BER_TYPE_OCTET_STRING, ROWS_INTERFACES, GROUP_INTERFACES, 0,          get_mac,            NONE },
+	{ &m_if_2_oid,      7, BER_TYPE_INTEGER,      ROWS_INTERFACES, GROUP_INTERFACES, COL_LINK,   get_admin,          NONE },
+	{ &m_if_2_oid,      8, BER_TYPE_INTEGER,      ROWS_INTERFACES, GROUP_INTERFACES, COL_LINK,   get_uint_column,    STATS(netinfo_t, status) },
+	{ &m_if_2_oid,      9, BER_TYPE_TIME_TICKS,   ROWS_INTERFACES, GROUP_INTERFACES, COL_LINK,   get_uint_column,    STATS(netinfo_t, lastchange) },
+	{ &m_if_2_oid,     10, BER_TYPE_COUNTER,      ROWS_INTERFACES, GROUP_INTERFACES, 0,          get_counter_column, STATS(netinfo_t, rx_bytes) },
+	{ &m_if_2_oid,     11, BER_TYPE_COUNTER,      ROWS_INTERFACES, GROUP_INTERFACES, 0,          get_counter_column, STATS(netinfo_t, rx_packets) },
+	{ &m_if_2_oid,     13, BER_TYPE_COUNTER,      ROWS_INTERFACES, GROUP_INTERFACES, 0,          get_counter_column, STATS(netinfo_t, rx_drops) },
+	{ &m_if_2_oid,     14, BER_TYPE_COUNTER,      ROWS_INTERFACES, GROUP_INTERFACES, 0,          get_counter_column, STATS(netinfo_t, rx_errors) },
+	{ &m_if_2_oid,     16, BER_TYPE_COUNTER,      ROWS_INTERFACES, GROUP_INTERFACES, 0,          get_counter_column, STATS(netinfo_t, tx_bytes) },
+	{ &m_if_2_oid,     17, BER_TYPE_COUNTER,      ROWS_INTERFACES, GROUP_INTERFACES, 0,          get_counter_column, STATS(netinfo_t, tx_packets) },
+	{ &m_if_2_oid,     19, BER_TYPE_COUNTER,      ROWS_INTERFACES, GROUP_INTERFACES, 0,          get_counter_column, STATS(netinfo_t, tx_drops) },
+	{ &m_if_2_oid,     20, BER_TYPE_COUNTER,      ROWS_INTERFACES, GROUP_INTERFACES, 0,          get_counter_column, STATS(netinfo_t, tx_errors) },
+
+	/* The IP-MIB, its ipAddrTable is indexed by address, see update_ipaddr() */
+	{ &m_ip_oid,        1, BER_TYPE_INTEGER,      ROWS_SCALAR,     GROUP_IP,         0,          get_llong,          STATS(protoinfo_t, ip.ipForwarding) },
+	{ &m_ip_oid,        2, BER_TYPE_INTEGER,      ROWS_SCALAR,     GROUP_IP,         0,          get_llong,          STATS(protoinfo_t, ip.ipDefaultTTL) },
+	{ &m_ip_oid,       13, BER_TYPE_INTEGER,      ROWS_SCALAR,     GROUP_IP,         0,          get_llong,          STATS(protoinfo_t, ip.ipReasmTimeout) },
+
+	/* The TCP-MIB */
+	{ &m_tcp_oid,       1, BER_TYPE_INTEGER,      ROWS_SCALAR,     GROUP_TCP,        0,          get_llong,          STATS(protoinfo_t, tcp.tcpRtoAlgorithm) },
+	{ &m_tcp_oid,       2, BER_TYPE_INTEGER,      ROWS_SCALAR,     GROUP_TCP,        0,          get_llong,          STATS(protoinfo_t, tcp.tcpRtoMin) },
+	{ &m_tcp_oid,       3, BER_TYPE_INTEGER,      ROWS_SCALAR,     GROUP_TCP,        0,          get_llong,          STATS(protoinfo_t, tcp.tcpRtoMax) },
+	{ &m_tcp_oid,       4, BER_TYPE_INTEGER,      ROWS_SCALAR,     GROUP_TCP,        0,          get_llong,          STATS(protoinfo_t, tcp.tcpMaxConn) },
+	{ &m_tcp_oid,       5, BER_TYPE_COUNTER,      ROWS_SCALAR,     GROUP_TCP,        0,          get_llong,          STATS(protoinfo_t, tcp.tcpActiveOpens) },
+	{ &m_tcp_oid,       6, BER_TYPE_COUNTER,      ROWS_SCALAR,     GROUP_TCP,        0,          get_llong,          STATS(protoinfo_t, tcp.tcpPassiveOpens) },
+	{ &m_tcp_oid,       7, BER_TYPE_COUNTER,      ROWS_SCALAR,     GROUP_TCP,        0,          get_llong,          STATS(protoinfo_t, tcp.tcpAttemptFails) },
+	{ &m_tcp_oid,       8, BER_TYPE_COUNTER,      ROWS_SCALAR,     GROUP_TCP,        0,          get_llong,          STATS(protoinfo_t, tcp.tcpEstabResets) },
+	{ &m_tcp_oid,       9, BER_TYPE_GAUGE,        ROWS_SCALAR,     GROUP_TCP,        0,          get_llong,          STATS(protoinfo_t, tcp.tcpCurrEstab) },
+	{ &m_tcp_oid,      10, BER_TYPE_COUNTER,      ROWS_SCALAR,     GROUP_TCP,        0,          get_llong,          STATS(protoinfo_t, tcp.tcpInSegs) },
+	{ &m_tcp_oid,      11, BER_TYPE_COUNTER,      ROWS_SCALAR,     GROUP_TCP,        0,          get_llong,          STATS(protoinfo_t, tcp.tcpOutSegs) },
+	{ &m_tcp_oid,      12, BER_TYPE_COUNTER,      ROWS_SCALAR,     GROUP_TCP,        0,          get_llong,          STATS(protoinfo_t, tcp.tcpRetransSegs) },
+	{ &m_tcp_oid,      14, BER_TYPE_COUNTER,      ROWS_SCALAR,     GROUP_TCP,        0,          get_llong,          STATS(protoinfo_t, tcp.tcpInErrs) },
+	{ &m_tcp_oid,      15, BER_TYPE_COUNTER,      ROWS_SCALAR,     GROUP_TCP,        0,          get_llong,          STATS(protoinfo_t, tcp.tcpOutRsts) },
+
+	/* The UDP-MIB */
+	{ &m_udp_oid,       1, BER_TYPE_COUNTER,      ROWS_SCALAR,     GROUP_UDP,        0,          get_counter,        STATS(protoinfo_t, udp.udpInDatagrams) },
+	{ &m_udp_oid,       2, BER_TYPE_COUNTER,      ROWS_SCALAR,     GROUP_UDP,        0,          get_counter,        STATS(protoinfo_t, udp.udpNoPorts) },
+	{ &m_udp_oid,       3, BER_TYPE_COUNTER,      ROWS_SCALAR,     GROUP_UDP,        0,          get_counter,        STATS(protoinfo_t, udp.udpInErrors) },
+	{ &m_udp_oid,       4, BER_TYPE_COUNTER,      ROWS_SCALAR,     GROUP_UDP,        0,          get_counter,        STATS(protoinfo_t, udp.udpOutDatagrams) },
+	{ &m_udp_oid,       8, BER_TYPE_COUNTER64,    ROWS_SCALAR,     GROUP_UDP,        0,          get_counter,        STATS(protoinfo_t, udp.udpInDatagrams) },
+	{ &m_udp_oid,       9, BER_TYPE_COUNTER64,    ROWS_SCALAR,     GROUP_UDP,        0,          get_counter,        STATS(protoinfo_t, udp.udpOutDatagrams) },
+
+	/* The host MIB: additional host info (HOST-RESOURCES-MIB.txt) */
+	{ &m_host_oid,      1, BER_TYPE_TIME_TICKS,   ROWS_SCALAR,     GROUP_HOST,       0,          get_host_uptime,    NONE },
+
+	/* IF-MIB continuation, the ifXTable */
+	{ &m_ifxtable_oid,  1, BER_TYPE_OCTET_STRING, ROWS_INTERFACES, GROUP_IFXTABLE,   COL_STATIC, get_list,           GLOBAL(g_interface_list) },
+	{ &m_ifxtable_oid,  2, BER_TYPE_COUNTER,      ROWS_INTERFACES, GROUP_IFXTABLE,   0,          get_counter_column, STATS(netinfo_t, rx_mc_packets) },
+	{ &m_ifxtable_oid,  3, BER_TYPE_COUNTER,      ROWS_INTERFACES, GROUP_IFXTABLE,   0,          get_counter_column, STATS(netinfo_t, rx_bc_packets) },
+	{ &m_ifxtable_oid,  4, BER_TYPE_COUNTER,      ROWS_INTERFACES, GROUP_IFXTABLE,   0,          get_counter_column, STATS(netinfo_t, tx_mc_packets) },
+	{ &m_ifxtable_oid,  5, BER_TYPE_COUNTER,      ROWS_INTERFACES, GROUP_IFXTABLE,   0,          get_counter_column, STATS(netinfo_t, tx_bc_packets) },
+	{ &m_ifxtable_oid,  6, BER_TYPE_COUNTER64,    ROWS_INTERFACES, GROUP_IFXTABLE,   0,          get_counter_column, STATS(netinfo_t, rx_bytes) },
+	{ &m_ifxtable_oid,  7, BER_TYPE_COUNTER64,    ROWS_INTERFACES, GROUP_IFXTABLE,   0,          get_counter_column, STATS(netinfo_t, rx_packets) },
+	{ &m_ifxtable_oid,  8, BER_TYPE_COUNTER64,    ROWS_INTERFACES, GROUP_IFXTABLE,   0,          get_counter_column, STATS(netinfo_t, rx_mc_packets) },
+	{ &m_ifxtable_oid,  9, BER_TYPE_COUNTER64,    ROWS_INTERFACES, GROUP_IFXTABLE,   0,          get_counter_column, STATS(netinfo_t, rx_bc_packets) },
+	{ &m_ifxtable_oid, 10, BER_TYPE_COUNTER64,    ROWS_INTERFACES, GROUP_IFXTABLE,   0,          get_counter_column, STATS(netinfo_t, tx_bytes) },
+	{ &m_ifxtable_oid, 11, BER_TYPE_COUNTER64,    ROWS_INTERFACES, GROUP_IFXTABLE,   0,          get_counter_column, STATS(netinfo_t, tx_packets) },
+	{ &m_ifxtable_oid, 12, BER_TYPE_COUNTER64,    ROWS_INTERFACES, GROUP_IFXTABLE,   0,          get_counter_column, STATS(netinfo_t, tx_mc_packets) },
+	{ &m_ifxtable_oid, 13, BER_TYPE_COUNTER64,    ROWS_INTERFACES, GROUP_IFXTABLE,   0,          get_counter_column, STATS(netinfo_t, tx_bc_packets) },
+	{ &m_ifxtable_oid, 14, BER_TYPE_INTEGER,      ROWS_INTERFACES, GROUP_IFXTABLE,   COL_STATIC, get_const,          CONST(2) },	/* ifLinkUpDownTrapEnable: disabled */
+	{ &m_ifxtable_oid, 15, BER_TYPE_GAUGE,        ROWS_INTERFACES, GROUP_IFXTABLE,   0,          get_high_speed,     NONE },
+	{ &m_ifxtable_oid, 16, BER_TYPE_INTEGER,      ROWS_INTERFACES, GROUP_IFXTABLE,   COL_STATIC, get_const,          CONST(2) },	/* ifPromiscuousMode: false */
+	{ &m_ifxtable_oid, 17, BER_TYPE_INTEGER,      ROWS_INTERFACES, GROUP_IFXTABLE,   COL_STATIC, get_const,          CONST(1) },	/* ifConnectorPresent: true */
+	{ &m_ifxtable_oid, 18, BER_TYPE_OCTET_STRING, ROWS_INTERFACES, GROUP_IFXTABLE,   COL_STATIC, get_list,           GLOBAL(g_interface_list) },
+	{ &m_ifxtable_oid, 19, BER_TYPE_TIME_TICKS,   ROWS_INTERFACES, GROUP_IFXTABLE,   0,          get_uint_column,    STATS(netinfo_t, discontinuity) },
+
+	/* The memory MIB: total/free memory (UCD-SNMP-MIB.txt) */
+	{ &m_memory_oid,    5, BER_TYPE_INTEGER,      ROWS_SCALAR,     GROUP_MEMORY,     0,          get_llong,          STATS(meminfo_t, total) },
+	{ &m_memory_oid,    6, BER_TYPE_INTEGER,      ROWS_SCALAR,     GROUP_MEMORY,     0,          get_llong,          STATS(meminfo_t, free) },
+	{ &m_memory_oid,   13, BER_TYPE_INTEGER,      ROWS_SCALAR,     GROUP_MEMORY,     0,          get_llong,          STATS(meminfo_t, shared) },
+	{ &m_memory_oid,   14, BER_TYPE_INTEGER,      ROWS_SCALAR,     GROUP_MEMORY,     0,          get_llong,          STATS(meminfo_t, buffers) },
+	{ &m_memory_oid,   15, BER_TYPE_INTEGER,      ROWS_SCALAR,     GROUP_MEMORY,     0,          get_llong,          STATS(meminfo_t, cached) },
+
+	/* The disk MIB: mounted partitions (UCD-SNMP-MIB.txt) */
+	{ &m_disk_oid,      1, BER_TYPE_INTEGER,      ROWS_DISKS,      GROUP_DISK,       COL_STATIC, get_row,            NONE },
+	{ &m_disk_oid,      2, BER_TYPE_OCTET_STRING, ROWS_DISKS,      GROUP_DISK,       COL_STATIC, get_list,           GLOBAL(g_disk_list) },
+	{ &m_disk_oid,      6, BER_TYPE_INTEGER,      ROWS_DISKS,      GROUP_DISK,       0,          get_uint_column,    STATS(diskinfo_t, total) },
+	{ &m_disk_oid,      7, BER_TYPE_INTEGER,      ROWS_DISKS,      GROUP_DISK,       0,          get_uint_column,    STATS(diskinfo_t, free) },
+	{ &m_disk_oid,      8, BER_TYPE_INTEGER,      ROWS_DISKS,      GROUP_DISK,       0,          get_uint_column,    STATS(diskinfo_t, used) },
+	{ &m_disk_oid,      9, BER_TYPE_INTEGER,      ROWS_DISKS,      GROUP_DISK,       0,          get_uint_column,    STATS(diskinfo_t, blocks_used_percent) },
+	{ &m_disk_oid,     10, BER_TYPE_INTEGER,      ROWS_DISKS,      GROUP_DISK,       0,          get_uint_column,    STATS(diskinfo_t, inodes_used_percent) },
+
+	/* The load MIB: CPU load averages (UCD-SNMP-MIB.txt) */
+	{ &m_load_oid,      1, BER_TYPE_INTEGER,      ROWS_LOAD,       GROUP_LOAD,       COL_STATIC, get_row,            NONE },
+	{ &m_load_oid,      2, BER_TYPE_OCTET_STRING, ROWS_LOAD,       GROUP_LOAD,       COL_STATIC, get_load_name,      NONE },
+	{ &m_load_oid,      3, BER_TYPE_OCTET_STRING, ROWS_LOAD,       GROUP_LOAD,       0,          get_load_avg,       NONE },
+	{ &m_load_oid,      4, BER_TYPE_OCTET_STRING, ROWS_LOAD,       GROUP_LOAD,       COL_STATIC, get_load_time,      NONE },
+	{ &m_load_oid,      5, BER_TYPE_INTEGER,      ROWS_LOAD,       GROUP_LOAD,       0,          get_uint,           STATS(loadinfo_t, avg) },
+
+	/* The CPU MIB: CPU statistics (UCD-SNMP-MIB.txt) */
+	{ &m_cpu_oid,      50, BER_TYPE_COUNTER,      ROWS_SCALAR,     GROUP_CPU,        0,          get_llong,          STATS(cpuinfo_t, user) },
+	{ &m_cpu_oid,      51, BER_TYPE_COUNTER,      ROWS_SCALAR,     GROUP_CPU,        0,          get_llong,          STATS(cpuinfo_t, nice) },
+	{ &m_cpu_oid,      52, BER_TYPE_COUNTER,      ROWS_SCALAR,     GROUP_CPU,        0,          get_llong,          STATS(cpuinfo_t, system) },
+	{ &m_cpu_oid,      53, BER_TYPE_COUNTER,      ROWS_SCALAR,     GROUP_CPU,        0,          get_llong,          STATS(cpuinfo_t, idle) },
+	{ &m_cpu_oid,      59, BER_TYPE_COUNTER,      ROWS_SCALAR,     GROUP_CPU,        0,          get_llong,          STATS(cpuinfo_t, irqs) },
+	{ &m_cpu_oid,      60, BER_TYPE_COUNTER,      ROWS_SCALAR,     GROUP_CPU,        0,          get_llong,          STATS(cpuinfo_t, cntxts) },
+
+#ifdef CONFIG_ENABLE_RATES
 	/*
-	 * The host MIB: additional host info (HOST-RESOURCES-MIB.txt)
-	 * Caution: on changes, adapt the corresponding mib_update() section too!
+	 * Interface rates: the lengths of the windows in seconds, then a table
+	 * of the moving averages of each interface, per second, for each window
+	 * its rx bytes, tx bytes, rx packets and tx packets, as Counter64 since
+	 * they are CounterBasedGauge64 (HCNUM-TC)
 	 */
-	if (!mib_alloc_entry(&m_host_oid, 1, 0, BER_TYPE_TIME_TICKS))
+	{ &m_rates_1_oid,   1, BER_TYPE_INTEGER,      ROWS_SCALAR,     GROUP_RATES,      0,          get_uint,           STATS(rateinfo_t, window[0]) },
+	{ &m_rates_1_oid,   2, BER_TYPE_INTEGER,      ROWS_SCALAR,     GROUP_RATES,      0,          get_uint,           STATS(rateinfo_t, window[1]) },
+	{ &m_rates_1_oid,   3, BER_TYPE_INTEGER,      ROWS_SCALAR,     GROUP_RATES,      0,          get_uint,           STATS(rateinfo_t, window[2]) },
+	{ &m_rates_2_oid,   1, BER_TYPE_INTEGER,      ROWS_INTERFACES, GROUP_RATES,      COL_STATIC, get_row,            NONE },
+	{ &m_rates_2_oid,   2, BER_TYPE_OCTET_STRING, ROWS_INTERFACES, GROUP_RATES,      COL_STATIC, get_list,           GLOBAL(g_interface_list) },
+	{ &m_rates_2_oid,   3, BER_TYPE_COUNTER64,    ROWS_INTERFACES, GROUP_RATES,      0,          get_rate,           CONST(0) },
+	{ &m_rates_2_oid,   4, BER_TYPE_COUNTER64,    ROWS_INTERFACES, GROUP_RATES,      0,          get_rate,           CONST(1) },
+	{ &m_rates_2_oid,   5, BER_TYPE_COUNTER64,    ROWS_INTERFACES, GROUP_RATES,      0,          get_rate,           CONST(2) },
+	{ &m_rates_2_oid,   6, BER_TYPE_COUNTER64,    ROWS_INTERFACES, GROUP_RATES,      0,          get_rate,           CONST(3) },
+	{ &m_rates_2_oid,   7, BER_TYPE_COUNTER64,    ROWS_INTERFACES, GROUP_RATES,      0,          get_rate,           CONST(4) },
+	{ &m_rates_2_oid,   8, BER_TYPE_COUNTER64,    ROWS_INTERFACES, GROUP_RATES,      0,          get_rate,           CONST(5) },
+	{ &m_rates_2_oid,   9, BER_TYPE_COUNTER64,    ROWS_INTERFACES, GROUP_RATES,      0,          get_rate,           CONST(6) },
+	{ &m_rates_2_oid,  10, BER_TYPE_COUNTER64,    ROWS_INTERFACES, GROUP_RATES,      0,          get_rate,           CONST(7) },
+	{ &m_rates_2_oid,  11, BER_TYPE_COUNTER64,    ROWS_INTERFACES, GROUP_RATES,      0,          get_rate,           CONST(8) },
+	{ &m_rates_2_oid,  12, BER_TYPE_COUNTER64,    ROWS_INTERFACES, GROUP_RATES,      0,          get_rate,           CONST(9) },
+	{ &m_rates_2_oid,  13, BER_TYPE_COUNTER64,    ROWS_INTERFACES, GROUP_RATES,      0,          get_rate,           CONST(10) },
+	{ &m_rates_2_oid,  14, BER_TYPE_COUNTER64,    ROWS_INTERFACES, GROUP_RATES,      0,          get_rate,           CONST(11) },
+#endif
+#ifdef CONFIG_ENABLE_DEMO
+	/* The demo MIB: two random integers */
+	{ &m_demo_oid,      1, BER_TYPE_INTEGER,      ROWS_SCALAR,     GROUP_DEMO,       0,          get_uint,           STATS(demoinfo_t, random_value_1) },
+	{ &m_demo_oid,      2, BER_TYPE_INTEGER,      ROWS_SCALAR,     GROUP_DEMO,       0,          get_uint,           STATS(demoinfo_t, random_value_2) },
+#endif
+};
+
+/*
+ * The MIB groups and their refresh intervals in seconds, -1 means every
+ * "g_timeout" seconds and 0 means on every call to mib_update(), i.e.,
+ * on every SNMP request.  The intervals can be changed per group with
+ * mib_set_refresh(), e.g. to poll statfs() less often than counters.
+ * A refresh reads the statistics of the group, sets its columns in
+ * m_column[] and calls its update function for any other entries.  The
+ * entries of each group, found by OID, are recorded by mib_build() for
+ * the lazy mode, where only the groups requested are refreshed.  Groups
+ * may be nested, like ipaddr in ip, an entry then belongs to the group
+ * with the longest OID.
+ *
+ * Note: the random numbers of the demo group are only updated every
+ *       "g_timeout" seconds, set its refresh interval to zero to update
+ *       them on every SNMP request.  The rates group lives below the
+ *       demo OID, so the range of demo entries recorded spans the rates
+ *       too, it is nested like ipaddr and never refreshes them itself.
+ */
+static struct mib_group {
+	const char         *name;
+	const oid_t        *oid;
+	const void       *(*data)(void);
+	int               (*update)(const void *src);
+	int                 interval;
+	int                 valid;
+	unsigned long long  last;
+	size_t              first;
+	size_t              end;
+} m_group[] = {
+	[GROUP_SYSTEM]     = { "system",     &m_system_oid,   NULL,            NULL,           0, 0, 0, 0, 0 },
+	[GROUP_INTERFACES] = { "interfaces", &m_if_1_oid,     group_netinfo,   NULL,          -1, 0, 0, 0, 0 },
+	[GROUP_IP]         = { "ip",         &m_ip_oid,       group_protoinfo, NULL,          -1, 0, 0, 0, 0 },
+	[GROUP_IPADDR]     = { "ipaddr",     &m_ipaddr_oid,   group_netinfo,   update_ipaddr, -1, 0, 0, 0, 0 },
+	[GROUP_TCP]        = { "tcp",        &m_tcp_oid,      group_protoinfo, NULL,          -1, 0, 0, 0, 0 },
+	[GROUP_UDP]        = { "udp",        &m_udp_oid,      group_protoinfo, NULL,          -1, 0, 0, 0, 0 },
+	[GROUP_HOST]       = { "host",       &m_host_oid,     NULL,            NULL,           0, 0, 0, 0, 0 },
+	[GROUP_IFXTABLE]   = { "ifxtable",   &m_ifxtable_oid, group_netinfo,   NULL,          -1, 0, 0, 0, 0 },
+	[GROUP_MEMORY]     = { "memory",     &m_memory_oid,   group_meminfo,   NULL,          -1, 0, 0, 0, 0 },
+	[GROUP_DISK]       = { "disk",       &m_disk_oid,     group_diskinfo,  NULL,          -1, 0, 0, 0, 0 },
+	[GROUP_LOAD]       = { "load",       &m_load_oid,     group_loadinfo,  NULL,          -1, 0, 0, 0, 0 },
+	[GROUP_CPU]        = { "cpu",        &m_cpu_oid,      group_cpuinfo,   NULL,          -1, 0, 0, 0, 0 },
+#ifdef CONFIG_ENABLE_RATES
+	[GROUP_RATES]      = { "rates",      &m_rates_1_oid,  group_rateinfo,  NULL,          -1, 0, 0, 0, 0 },
+#endif
+#ifdef CONFIG_ENABLE_DEMO
+	[GROUP_DEMO]       = { "demo",       &m_demo_oid,     group_demoinfo,  NULL,          -1, 0, 0, 0, 0 },
+#endif
+};
+
+/*
+ * The slot in g_mib of the first row of each column, and the number of
+ * rows bound to slots, see mib_bind_slots(), the others are searched for
+ */
+static struct {
+	size_t slot;
+	size_t bound;
+} m_column_slot[NELEMS(m_column)];
+
+/* The number of rows of the tables of a row source */
+static size_t rows_count(int rows)
+{
+	switch (rows) {
+	case ROWS_INTERFACES:
+		return g_interface_list_length;
+
+	case ROWS_DISKS:
+		return g_disk_list_length;
+
+	case ROWS_LOAD:
+		return NELEMS(m_load_avg_times);
+
+	default:
+		break;
+	}
+
+	return 1;
+}
+
+/*
+ * The index of row i of the tables of a row source, ascending with i.
+ * Scalars have row 0, interfaces their ifIndex, disks the index given
+ * by disk_discover(), others count from 1.
+ */
+static unsigned int rows_key(int rows, size_t i)
+{
+	switch (rows) {
+	case ROWS_SCALAR:
+		return 0;
+
+	case ROWS_INTERFACES:
+		return g_interface_index[i];
+
+	case ROWS_DISKS:
+		return g_disk_index[i];
+
+	default:
+		break;
+	}
+
+	return i + 1;
+}
+
+static size_t column_rows(const struct mib_column *col)
+{
+	return rows_count(col->rows);
+}
+
+static int column_row(const struct mib_column *col, size_t i)
+{
+	return rows_key(col->rows, i);
+}
+
+/* Set a cell of a column in its MIB entry, from the statistics src */
+static int column_set(const struct mib_column *col, value_t *value, const void *src, size_t i)
+{
+	struct mib_cell cell;
+	const void *arg;
+	int row = column_row(col, i);
+
+	cell.num = 0;
+	cell.count = 0;
+	cell.str = NULL;
+	cell.len = 0;
+	col->get(col, src, i, &cell);
+
+	switch (col->type) {
+	case BER_TYPE_OCTET_STRING:
+		if (cell.len)
+			return mib_byte_array_set(col->oid, value, col->column, row, cell.str, cell.len);
+		/* fallthrough */
+	case BER_TYPE_OID:
+		arg = cell.str;
+		break;
+
+	case BER_TYPE_COUNTER64:
+		arg = &cell.count;
+		break;
+
+	default:
+		arg = (const void *)(intptr_t)(unsigned int)cell.num;
+		break;
+	}
+
+	return mib_data_set(col->oid, value, col->column, row, col->type, arg);
+}
+
+/* The MIB entry of a cell, found by the slot of its column if bound */
+static value_t *column_value(const struct mib_column *col, size_t i)
+{
+	const char *msg = "Failed updating OID";
+	int row = column_row(col, i);
+	value_t *value;
+	size_t pos = 0;
+	oid_t oid;
+
+	if (i < m_column_slot[col - m_column].bound)
+		return &g_mib[m_column_slot[col - m_column].slot + i];
+
+	if (oid_build(&oid, col->oid, col->column, row)) {
+		logit(LOG_ERR, 0, "%s '%s.%d.%d': OID overflow", msg, oid_ntoa(col->oid), col->column, row);
+		return NULL;
+	}
+
+	value = mib_lookup_update(&oid, &pos);
+	if (!value)
+		logit(LOG_ERR, 0, "%s '%s.%d.%d': OID not found", msg, oid_ntoa(col->oid), col->column, row);
+
+	return value;
+}
+
+/* Read the statistics of each group with columns of the given rows, or all */
+static void groups_read(const void *src[], int rows)
+{
+	int read[NELEMS(m_group)] = { 0 };
+	size_t i;
+
+	for (i = 0; i < NELEMS(m_column); i++) {
+		const struct mib_column *col = &m_column[i];
+		struct mib_group *grp = &m_group[col->group];
+
+		if (read[col->group] || (rows >= 0 && col->rows != rows))
+			continue;
+
+		src[col->group]  = grp->data ? grp->data() : NULL;
+		read[col->group] = 1;
+	}
+}
+
+/* Create the entry of row i of a column, with its value from src */
+static int column_add(const struct mib_column *col, const void *src, size_t i)
+{
+	value_t *value;
+
+	value = mib_alloc_entry(col->oid, col->column, column_row(col, i), col->type);
+	if (!value || column_set(col, value, src, i))
 		return -1;
 
-	/*
-	 * IF-MIB continuation
-	 * ifXTable
-	 */
-	if (g_interface_list_length > 0) {
+	return 0;
+}
+
+/* Create the entries of all columns, with their initial values */
+static int columns_build(void)
+{
+	const void *src[NELEMS(m_group)];
+	size_t i, j;
 
-		/* ifName */
-		for (i = 0; i < g_interface_list_length; i++) {
-			if (build_str(&m_ifxtable_oid, 1, i + 1, g_interface_list[i]) == -1)
+	groups_read(src, -1);
+	for (i = 0; i < NELEMS(m_column); i++) {
+		const struct mib_column *col = &m_column[i];
+
+		for (j = 0; j < column_rows(col); j++) {
+			if (column_add(col, src[col->group], j))
 				return -1;
 		}
+	}
 
-		/* Counters */
-		if (mib_build_entries(&m_ifxtable_oid,  2, 1, g_interface_list_length, BER_TYPE_COUNTER)   == -1 ||
-		    mib_build_entries(&m_ifxtable_oid,  3, 1, g_interface_list_length, BER_TYPE_COUNTER)   == -1 ||
-		    mib_build_entries(&m_ifxtable_oid,  4, 1, g_interface_list_length, BER_TYPE_COUNTER)   == -1 ||
-		    mib_build_entries(&m_ifxtable_oid,  5, 1, g_interface_list_length, BER_TYPE_COUNTER)   == -1 ||
-		    mib_build_entries(&m_ifxtable_oid,  6, 1, g_interface_list_length, BER_TYPE_COUNTER64) == -1 ||
-		    mib_build_entries(&m_ifxtable_oid,  7, 1, g_interface_list_length, BER_TYPE_COUNTER64) == -1 ||
-		    mib_build_entries(&m_ifxtable_oid,  8, 1, g_interface_list_length, BER_TYPE_COUNTER64) == -1 ||
-		    mib_build_entries(&m_ifxtable_oid,  9, 1, g_interface_list_length, BER_TYPE_COUNTER64) == -1 ||
-		    mib_build_entries(&m_ifxtable_oid, 10, 1, g_interface_list_length, BER_TYPE_COUNTER64) == -1 ||
-		    mib_build_entries(&m_ifxtable_oid, 11, 1, g_interface_list_length, BER_TYPE_COUNTER64) == -1 ||
-		    mib_build_entries(&m_ifxtable_oid, 12, 1, g_interface_list_length, BER_TYPE_COUNTER64) == -1 ||
-		    mib_build_entries(&m_ifxtable_oid, 13, 1, g_interface_list_length, BER_TYPE_COUNTER64) == -1)
-			return -1;
+	return 0;
+}
+
+/*
+ * Set the columns of a group, only those with one of the flags if given.
+ * Columns only set when the MIB is built are skipped, unless asked for.
+ */
+static int columns_update(int group, const void *src, int flags)
+{
+	size_t i, j;
+
+	for (i = 0; i < NELEMS(m_column); i++) {
+		const struct mib_column *col = &m_column[i];
+
+		if (col->group != group || ((col->flags & COL_STATIC) && !(flags & COL_STATIC)))
+			continue;
+		if (flags && !(col->flags & flags))
+			continue;
 
-		/* ifLinkUpDownTrapEnable */
-		for (i = 0; i < g_interface_list_length; i++) {
-			if (build_int(&m_ifxtable_oid, 14, i + 1, 2 /* disabled */) == -1)
+		for (j = 0; j < column_rows(col); j++) {
+			value_t *value;
+
+			value = column_value(col, j);
+			if (!value || column_set(col, value, src, j))
 				return -1;
 		}
+	}
+
+	return 0;
+}
+
+static int mib_cmp(const void *a, const void *b)
+{
+	const mib_oid_t *oid1 = &((const value_t *)a)->oid;
+	const mib_oid_t *oid2 = &((const value_t *)b)->oid;
+
+	return subid_cmp(oid1->subid_list, oid1->subid_list_length, oid2->subid_list, oid2->subid_list_length);
+}
+
+static int pos_cmp(const void *a, const void *b)
+{
+	size_t pos1 = *(const size_t *)a;
+	size_t pos2 = *(const size_t *)b;
+
+	if (pos1 < pos2)
+		return -1;
+
+	return pos1 > pos2;
+}
+
+/* Free the OID and value of an entry removed, unless they are in the arena */
+static void value_free(value_t *value)
+{
+	if (!in_arena(&m_arena, (const unsigned char *)value->oid.subid_list))
+		free((void *)value->oid.subid_list);
+	if (!in_arena(&m_arena, value->data.buffer))
+		free(value->data.buffer);
+}
+
+/* Remove the entries at the given positions, in ascending order, from the MIB */
+static void mib_drop(const size_t *pos, size_t num)
+{
+	size_t i, j, k = 0;
+
+	for (i = j = 0; i < g_mib_length; i++) {
+		if (k < num && pos[k] == i) {
+			value_free(&g_mib[i]);
+			k++;
+			continue;
+		}
+
+		if (i != j)
+			g_mib[j] = g_mib[i];
+		j++;
+	}
+
+	g_mib_length = j;
+}
+
+/*
+ * Merge the entries appended to the MIB, from position from, into the
+ * sorted entries before them.  Only the new entries are sorted, and each
+ * entry is moved at most once, from the end.
+ */
+static int mib_merge(size_t from)
+{
+	size_t i, j, k, num = g_mib_length - from;
+	value_t *tail;
+
+	if (!num)
+		return 0;
+
+	qsort(&g_mib[from], num, sizeof(g_mib[0]), mib_cmp);
+	tail = malloc(num * sizeof(*tail));
+	if (!tail) {
+		logit(LOG_ERR, errno, "Failed merging MIB entries");
+		return -1;
+	}
+	memcpy(tail, &g_mib[from], num * sizeof(*tail));
+
+	i = from;
+	j = num;
+	k = g_mib_length;
+	while (j > 0) {
+		if (i > 0 && mib_cmp(&g_mib[i - 1], &tail[j - 1]) > 0)
+			g_mib[--k] = g_mib[--i];
+		else
+			g_mib[--k] = tail[--j];
+	}
+	free(tail);
+
+	return 0;
+}
+
+/*
+ * Entries have been added to or removed from the MIB, or it is new, find
+ * the entries of each group and column again and collect all OIDs and
+ * values in a new arena
+ */
+static int mib_relayout(void)
+{
+	mib_bind_groups();
+	mib_bind_slots();
+
+	if (arena_pack(&m_arena, g_mib, g_mib_length, 1)) {
+		logit(LOG_ERR, errno, "Failed allocating MIB values");
+		return -1;
+	}
+#ifdef CONFIG_ENABLE_THREADS
+	m_layout++;
+#endif
+
+	return 0;
+}
+
+/* Size the record of the rows in the MIB, to be filled in by the caller */
+static int rows_resize(struct mib_rows *kept, size_t num)
+{
+	unsigned int *key;
+
+	key = realloc(kept->key, (num + 1) * sizeof(*key));
+	if (!key) {
+		logit(LOG_ERR, errno, "Failed allocating MIB rows");
+		return -1;
+	}
+	kept->key    = key;
+	kept->length = num;
+
+	return 0;
+}
+
+/* Record the index of the rows of a row source in the MIB, for rows_sync() */
+static int rows_keep(int rows, struct mib_rows *kept)
+{
+	size_t i, num = rows_count(rows);
+
+	if (rows_resize(kept, num))
+		return -1;
+
+	for (i = 0; i < num; i++)
+		kept->key[i] = rows_key(rows, i);
+
+	return 0;
+}
+
+/* Remove the entries of the given OIDs, those not found are skipped */
+static int mib_remove(const oid_t *oid, size_t num)
+{
+	size_t i, *drop, dropped = 0;
+
+	drop = calloc(num + 1, sizeof(*drop));
+	if (!drop) {
+		logit(LOG_ERR, errno, "Failed removing MIB entries");
+		return -1;
+	}
+
+	for (i = 0; i < num; i++) {
+		size_t pos = 0;
+
+		if (mib_lookup_update(&oid[i], &pos))
+			drop[dropped++] = pos;
+	}
+
+	qsort(drop, dropped, sizeof(*drop), pos_cmp);
+	mib_drop(drop, dropped);
+	free(drop);
+
+	return 0;
+}
+
+/*
+ * Add and remove the rows of the tables of a row source, e.g. when an
+ * interface appears or vanishes.  The entries of the rows in the MIB,
+ * kept, that are no longer there are dropped and those of the rows added
+ * are created and merged in, leaving all others as they are.  The index
+ * of the rows, in kept and by rows_key(), is in ascending order.
+ */
+static int rows_sync(int rows, struct mib_rows *kept)
+{
+	const void *src[NELEMS(m_group)];
+	size_t i, j, k, from, num = rows_count(rows);
+	size_t columns = 0, removed = 0;
+	oid_t *oid;
+
+	for (k = 0; k < NELEMS(m_column); k++) {
+		if (m_column[k].rows == rows)
+			columns++;
+	}
+
+	oid = calloc(kept->length * columns + 1, sizeof(*oid));
+	if (!oid) {
+		logit(LOG_ERR, errno, "Failed removing MIB entries");
+		return -1;
+	}
+
+	for (i = j = 0; i < kept->length; i++) {
+		while (j < num && rows_key(rows, j) < kept->key[i])
+			j++;
+		if (j < num && rows_key(rows, j) == kept->key[i])
+			continue;
+
+		for (k = 0; k < NELEMS(m_column); k++) {
+			const struct mib_column *col = &m_column[k];
+
+			if (col->rows == rows && !oid_build(&oid[removed], col->oid, col->column, kept->key[i]))
+				removed++;
+		}
+	}
+
+	if (mib_remove(oid, removed)) {
+		free(oid);
+		return -1;
+	}
+	free(oid);
+
+	groups_read(src, rows);
+	from = g_mib_length;
+	for (i = j = 0; i < num; i++) {
+		unsigned int key = rows_key(rows, i);
+
+		while (j < kept->length && kept->key[j] < key)
+			j++;
+		if (j < kept->length && kept->key[j] == key)
+			continue;
 
-		/* ifHighSpeed */
-		for (i = 0; i < g_interface_list_length; i++) {
-			if (build_gge(&m_ifxtable_oid, 15, i + 1, 0) == -1)
+		for (k = 0; k < NELEMS(m_column); k++) {
+			const struct mib_column *col = &m_column[k];
+
+			if (col->rows == rows && column_add(col, src[col->group], i))
 				return -1;
 		}
+	}
+
+	if (mib_merge(from) || rows_keep(rows, kept))
+		return -1;
+
+	return mib_relayout();
+}
 
-		/* ifPromiscuousMode */
-		for (i = 0; i < g_interface_list_length; i++) {
-			if (build_int(&m_ifxtable_oid, 16, i + 1, 2 /* false */) == -1)
+/*
+ * Add and remove the rows of the ipAddrTable for the addresses listed in
+ * m_ipaddr by ipaddr_list() from netinfo, like rows_sync().
+ */
+static int ipaddr_sync(const netinfo_t *netinfo, size_t num)
+{
+	size_t i, j, from, removed = 0;
+	int column;
+	oid_t *oid;
+
+	oid = calloc(m_ipaddr_rows.length * IPADDR_COLUMNS + 1, sizeof(*oid));
+	if (!oid) {
+		logit(LOG_ERR, errno, "Failed removing MIB entries");
+		return -1;
+	}
+
+	for (i = j = 0; i < m_ipaddr_rows.length; i++) {
+		while (j < num && m_ipaddr[j].addr < m_ipaddr_rows.key[i])
+			j++;
+		if (j < num && m_ipaddr[j].addr == m_ipaddr_rows.key[i])
+			continue;
+
+		for (column = 1; column <= IPADDR_COLUMNS; column++)
+			ipaddr_oid(&oid[removed++], column, m_ipaddr_rows.key[i]);
+	}
+
+	if (mib_remove(oid, removed)) {
+		free(oid);
+		return -1;
+	}
+	free(oid);
+
+	from = g_mib_length;
+	for (i = j = 0; i < num; i++) {
+		while (j < m_ipaddr_rows.length && m_ipaddr_rows.key[j] < m_ipaddr[i].addr)
+			j++;
+		if (j < m_ipaddr_rows.length && m_ipaddr_rows.key[j] == m_ipaddr[i].addr)
+			continue;
+
+		for (column = 1; column <= IPADDR_COLUMNS; column++) {
+			const void *arg;
+			oid_t entry;
+			int type;
+
+			ipaddr_oid(&entry, column, m_ipaddr[i].addr);
+			type = ipaddr_cell(netinfo, m_ipaddr[i].pos, column, &arg);
+			if (mib_build_ip_entry(&entry, type, arg))
 				return -1;
 		}
+	}
+
+	if (mib_merge(from) || rows_resize(&m_ipaddr_rows, num))
+		return -1;
+
+	for (i = 0; i < num; i++)
+		m_ipaddr_rows.key[i] = m_ipaddr[i].addr;
+	m_ipaddr_stale = 0;
+
+	return mib_relayout();
+}
+
+/*
+ * Discover the interfaces again and add or remove their rows.  Returns 1
+ * if they have changed, then the interfaces group is refreshed next time.
+ */
+static int interfaces_sync(void)
+{
+	static const int groups[] = {
+		GROUP_INTERFACES,
+		GROUP_IFXTABLE,
+#ifdef CONFIG_ENABLE_RATES
+		GROUP_RATES,
+#endif
+	};
+	size_t i;
+	int rc;
+
+	rc = interface_discover();
+	if (rc <= 0)
+		return rc;
+
+	if (mib_alloc_netinfo() || rows_sync(ROWS_INTERFACES, &m_if_rows))
+		return -1;
+
+	/*
+	 * Rows are kept by ifIndex, so a renamed interface keeps its row with
+	 * the old name.  Set the names again, like mib_reload(), none of these
+	 * columns read the statistics of their group.
+	 */
+	for (i = 0; i < NELEMS(groups); i++) {
+		if (columns_update(groups[i], NULL, COL_STATIC))
+			return -1;
+	}
+
+	/* E.g. ifNumber and the addresses of the new interfaces */
+	m_group[GROUP_INTERFACES].valid = 0;
+	m_group[GROUP_IPADDR].valid = 0;
+
+	return 1;
+}
+
+/* Discover the disks again, if any are patterns, and add or remove their rows */
+static int disks_sync(void)
+{
+	int rc;
+
+	rc = disk_discover();
+	if (rc <= 0)
+		return rc;
+
+	if (diskinfo_alloc(&m_diskinfo, g_disk_list_length) || rows_sync(ROWS_DISKS, &m_disk_rows))
+		return -1;
+
+	return 1;
+}
+
+/* -----------------------------------------------------------------------------
+ * Interface functions
+ *
+ * To extend the MIB, describe the new variable, or column of a MIB table, in
+ * m_column[], and add a group to m_group[] if it needs statistics of its own.
+ * mib_build() creates the entries of each column, and mib_update() refreshes
+ * them with their group.  How to get the value for a variable is up to you,
+ * but bear in mind that the mib_update() function may be called between
+ * receiving the request from the client and sending back the response; thus
+ * you should avoid time-consuming actions, or give the group a longer refresh
+ * interval!
+ *
+ * The variable types supported up to now are OCTET_STRING, INTEGER (32 bit
+ * signed), COUNTER (32 bit unsigned), COUNTER64, GAUGE, TIME_TICKS (32 bit
+ * unsigned, in 1/100s), IP_ADDRESS and OID.
+ *
+ * The MIB array is sized from the number of interfaces and disks when it is
+ * built, and grows if more entries are added.  It is then sorted by OID,
+ * since mib_find() and mib_findnext() use a binary search.
+ */
+
+int mib_build(void)
+{
+	size_t i;
+
+	/* The interfaces present, and disks mounted, of those given */
+	if (interface_discover() < 0 || disk_discover() < 0)
+		return -1;
+	m_discover_last = m_disk_discover_last = mib_ticks();
+
+	/*
+	 * Reserve room for the fixed entries, and those of each interface,
+	 * its ifTable, ifXTable and ipAddrTable rows, and each disk
+	 */
+	if (mib_reserve(64 + 40 * g_interface_list_length + 8 * g_disk_list_length) ||
+	    mib_alloc_stats()) {
+		logit(LOG_ERR, errno, "Failed allocating MIB");
+		return -1;
+	}
+
+	if (columns_build() || rows_keep(ROWS_INTERFACES, &m_if_rows) || rows_keep(ROWS_DISKS, &m_disk_rows))
+		return -1;
+
+	/* Lookups are binary searches, so sort the MIB by OID */
+	qsort(g_mib, g_mib_length, sizeof(g_mib[0]), mib_cmp);
+	for (i = 1; i < g_mib_length; i++) {
+		if (!mib_cmp(&g_mib[i - 1], &g_mib[i]))
+			logit(LOG_WARNING, 0, "MIB entry '%s' is a duplicate", mib_oid_ntoa(&g_mib[i].oid));
+	}
+
+	/* All entries are in place, collect their OIDs and values in one arena */
+	if (mib_relayout())
+		return -1;
+
+	/* The ipAddrTable of the IP-MIB, indexed by address, is merged in */
+	return update_ipaddr(netinfo_get());
+}
+
+/* Monotonic time in 1/100 seconds, the unit of g_timeout */
+unsigned long long mib_ticks(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		return 0;
+
+	return (unsigned long long)ts.tv_sec * 100 + ts.tv_nsec / 10000000;
+}
+
+static int group_interval(const struct mib_group *grp)
+{
+	if (grp->interval < 0)
+		return g_timeout;
+
+	return grp->interval * 100;
+}
+
+int mib_set_refresh(const char *group, int interval)
+{
+	size_t i;
+
+	for (i = 0; i < NELEMS(m_group); i++) {
+		if (strcmp(m_group[i].name, group))
+			continue;
+
+		m_group[i].interval = interval;
+		return 0;
+	}
+
+	logit(LOG_WARNING, 0, "Unknown MIB group '%s'", group);
+	return -1;
+}
+
+/* Ticks until the next MIB group is due, groups refreshed on every call excluded */
+int mib_timeout(void)
+{
+	unsigned long long now = mib_ticks();
+	int timeout = -1;
+	size_t i;
+
+	for (i = 0; i < NELEMS(m_group); i++) {
+		unsigned long long due;
+		int interval;
+
+		interval = group_interval(&m_group[i]);
+		if (interval <= 0)
+			continue;
+
+		due = m_group[i].last + interval;
+		if (due <= now)
+			return 0;
+
+		if (timeout < 0 || due - now < (unsigned long long)timeout)
+			timeout = due - now;
+	}
 
-		/* ifConnectorPresent */
-		for (i = 0; i < g_interface_list_length; i++) {
-			if (build_int(&m_ifxtable_oid, 17, i + 1, 1 /* true */) == -1)
-				return -1;
-		}
+	return timeout < 0 ? g_timeout : timeout;
+}
 
-		/* ifAlias */
-		for (i = 0; i < g_interface_list_length; i++) {
-			if (build_str(&m_ifxtable_oid, 18, i + 1, g_interface_list[i]) == -1)
-				return -1;
-		}
+/* Whether any MIB group is refreshed on every call to mib_update() */
+int mib_per_request(void)
+{
+	size_t i;
 
-		/* ifCounterDiscontinuityTime */
-		for (i = 0; i < g_interface_list_length; i++) {
-			if (build_tm(&m_ifxtable_oid, 19, i + 1, 0) == -1)
-				return -1;
-		}
+	for (i = 0; i < NELEMS(m_group); i++) {
+		if (group_interval(&m_group[i]) <= 0)
+			return 1;
 	}
 
-	/*
-	 * The memory MIB: total/free memory (UCD-SNMP-MIB.txt)
-	 * Caution: on changes, adapt the corresponding mib_update() section too!
-	 */
-	if (!mib_alloc_entry(&m_memory_oid,  5, 0, BER_TYPE_INTEGER) ||
-	    !mib_alloc_entry(&m_memory_oid,  6, 0, BER_TYPE_INTEGER) ||
-	    !mib_alloc_entry(&m_memory_oid, 13, 0, BER_TYPE_INTEGER) ||
-	    !mib_alloc_entry(&m_memory_oid, 14, 0, BER_TYPE_INTEGER) ||
-	    !mib_alloc_entry(&m_memory_oid, 15, 0, BER_TYPE_INTEGER))
+	return 0;
+}
+
+static int group_update(struct mib_group *grp, unsigned long long now, int full)
+{
+	const void *src;
+
+	if (!full && grp->valid && now - grp->last < (unsigned long long)group_interval(grp))
+		return 0;
+
+	src = grp->data ? grp->data() : NULL;
+	if (columns_update(grp - m_group, src, 0) || (grp->update && grp->update(src)))
 		return -1;
 
-	/*
-	 * The disk MIB: mounted partitions (UCD-SNMP-MIB.txt)
-	 * Caution: on changes, adapt the corresponding mib_update() section too!
-	 */
-	if (g_disk_list_length > 0) {
-		for (i = 0; i < g_disk_list_length; i++) {
-			if (build_int(&m_disk_oid, 1, i + 1, i + 1) == -1)
-				return -1;
-		}
+	grp->valid = 1;
+	grp->last  = now;
 
-		for (i = 0; i < g_disk_list_length; i++) {
-			if (build_str(&m_disk_oid, 2, i + 1, g_disk_list[i]) == -1)
-				return -1;
-		}
+	return 0;
+}
 
-		if (mib_build_entries(&m_disk_oid,  6, 1, g_disk_list_length, BER_TYPE_INTEGER) == -1 ||
-		    mib_build_entries(&m_disk_oid,  7, 1, g_disk_list_length, BER_TYPE_INTEGER) == -1 ||
-		    mib_build_entries(&m_disk_oid,  8, 1, g_disk_list_length, BER_TYPE_INTEGER) == -1 ||
-		    mib_build_entries(&m_disk_oid,  9, 1, g_disk_list_length, BER_TYPE_INTEGER) == -1 ||
-		    mib_build_entries(&m_disk_oid, 10, 1, g_disk_list_length, BER_TYPE_INTEGER) == -1)
+/*
+ * The interfaces and disks are discovered again with the refresh of their
+ * group, the interfaces right away when forced, e.g. by a link notification.
+ * Entries are added and removed, so this must never be called while a
+ * request is being served.
+ */
+static int mib_discover(unsigned long long now, int force)
+{
+	if (g_interface_glob_length &&
+	    (force || now - m_discover_last >= (unsigned long long)group_interval(&m_group[GROUP_INTERFACES]))) {
+		m_discover_last = now;
+		if (interfaces_sync() < 0)
 			return -1;
 	}
 
-	/*
-	 * The load MIB: CPU load averages (UCD-SNMP-MIB.txt)
-	 * Caution: on changes, adapt the corresponding mib_update() section too!
-	 */
-	for (i = 0; i < 3; i++) {
-		if (build_int(&m_load_oid, 1, i + 1, i + 1) == -1)
+	if (now - m_disk_discover_last >= (unsigned long long)group_interval(&m_group[GROUP_DISK])) {
+		m_disk_discover_last = now;
+		if (disks_sync() < 0)
 			return -1;
 	}
 
-	for (i = 0; i < 3; i++) {
-		snprintf(name, sizeof(name), "Load-%d", m_load_avg_times[i]);
-		if (build_str(&m_load_oid, 2, i + 1, name) == -1)
-			return -1;
-	}
+	/* Addresses changed while a request was served, in lazy mode */
+	if (m_ipaddr_stale && update_ipaddr(netinfo_get()))
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Refresh all MIB groups that are due, or every group if full is set.
+ * All other MIB entries keep their values from the previous refresh.
+ */
+int mib_update(int full)
+{
+	unsigned long long now = mib_ticks();
+	size_t i;
+
+	/* Shared statistics are fetched at most once per update */
+	cache_flush();
 
-	if (mib_build_entries(&m_load_oid, 3, 1, 3, BER_TYPE_OCTET_STRING) == -1)
+	if (mib_discover(now, full) < 0)
 		return -1;
 
-	for (i = 0; i < 3; i++) {
-		snprintf(name, sizeof(name), "%d", m_load_avg_times[i]);
-		if (build_str(&m_load_oid, 4, i + 1, name) == -1)
+	for (i = 0; i < NELEMS(m_group); i++) {
+		if (group_update(&m_group[i], now, full))
 			return -1;
 	}
 
-	if (mib_build_entries(&m_load_oid, 5, 1, 3, BER_TYPE_INTEGER) == -1)
-		return -1;
+	return 0;
+}
 
-	/* The CPU MIB: CPU statistics (UCD-SNMP-MIB.txt)
-	 * Caution: on changes, adapt the corresponding mib_update() section too!
-	 */
-	if (!mib_alloc_entry(&m_cpu_oid, 50, 0, BER_TYPE_COUNTER) ||
-	    !mib_alloc_entry(&m_cpu_oid, 51, 0, BER_TYPE_COUNTER) ||
-	    !mib_alloc_entry(&m_cpu_oid, 52, 0, BER_TYPE_COUNTER) ||
-	    !mib_alloc_entry(&m_cpu_oid, 53, 0, BER_TYPE_COUNTER) ||
-	    !mib_alloc_entry(&m_cpu_oid, 59, 0, BER_TYPE_COUNTER) ||
-	    !mib_alloc_entry(&m_cpu_oid, 60, 0, BER_TYPE_COUNTER))
-		return -1;
+/*
+ * Apply a new configuration, see config_reload().  The interfaces and disks
+ * given may have changed, and so may the values only set when the MIB was
+ * built, e.g. sysContact.  Rows are added and removed like on hotplug and
+ * all other entries are kept, then every group is refreshed next time.
+ */
+int mib_reload(void)
+{
+	const void *src[NELEMS(m_group)];
+	unsigned long long now = mib_ticks();
+	size_t i;
 
-	/* The demo MIB: two random integers
-	 * Caution: on changes, adapt the corresponding mib_update() section too!
-	 */
-#ifdef CONFIG_ENABLE_DEMO
-	if (!mib_alloc_entry(&m_demo_oid, 1, 0, BER_TYPE_INTEGER) ||
-	    !mib_alloc_entry(&m_demo_oid, 2, 0, BER_TYPE_INTEGER))
+	cache_flush();
+	if (interfaces_sync() < 0 || disks_sync() < 0)
 		return -1;
-#endif
+	m_discover_last = m_disk_discover_last = now;
+
+	groups_read(src, -1);
+	for (i = 0; i < NELEMS(m_group); i++) {
+		if (columns_update(i, src[i], COL_STATIC))
+			return -1;
+		m_group[i].valid = 0;
+	}
 
 	return 0;
 }
 
-int mib_update(int full)
+/*
+ * Link state and address changes signalled by the OS are applied to the
+ * MIB in place, instead of waiting for the interfaces group to be due.
+ * Interfaces created or removed are discovered right away, refreshing
+ * the whole group.  Returns 1 if the MIB was changed.
+ */
+int mib_link_event(void)
 {
-	char nr[16];
-	size_t i, pos;
-	union {
-		diskinfo_t diskinfo;
-		loadinfo_t loadinfo;
-		meminfo_t meminfo;
-		ipinfo_t ipinfo;
-		tcpinfo_t tcpinfo;
-		udpinfo_t udpinfo;
-		cpuinfo_t cpuinfo;
-#ifdef CONFIG_ENABLE_DEMO
-		demoinfo_t demoinfo;
-#endif
-	} u;
-	netinfo_t netinfo;
+	netinfo_t *netinfo = &m_linkinfo;
+	unsigned long long now;
+	int rc;
+
+	rc = netlink_event(netinfo);
+	if (rc <= 0)
+		return rc;
+
+	if (rc > 1) {
+		now = mib_ticks();
+		cache_flush();
+		if (mib_discover(now, 1) < 0 ||
+		    group_update(&m_group[GROUP_INTERFACES], now, 1) ||
+		    group_update(&m_group[GROUP_IPADDR], now, 1))
+			return -1;
 
-	/* Begin searching at the first MIB entry */
-	pos = 0;
+		return 1;
+	}
 
-	/*
-	 * The system MIB: basic info about the host (SNMPv2-MIB.txt)
-	 * Caution: on changes, adapt the corresponding mib_build() section too!
-	 */
-	if (mib_update_entry(&m_system_oid, 3, 0, &pos, BER_TYPE_TIME_TICKS, (const void *)(uintptr_t)get_process_uptime()) == -1)
+	if (columns_update(GROUP_INTERFACES, netinfo, COL_LINK) || update_ipaddr(netinfo))
 		return -1;
 
-	/*
-	 * The interface MIB: network interfaces (IF-MIB.txt)
-	 * Caution: on changes, adapt the corresponding mib_build() section too!
-	 */
-	if (full) {
-		if (g_interface_list_length > 0) {
-			get_netinfo(&netinfo);
-
-			for (i = 0; i < g_interface_list_length; i++) {
-				if (update_int(&m_if_2_oid, 3, i + 1, &pos, netinfo.if_type[i]) == -1)
-					return -1;
-			}
-
-			for (i = 0; i < g_interface_list_length; i++) {
-				if (update_int(&m_if_2_oid, 4, i + 1, &pos, netinfo.if_mtu[i]) == -1)
-					return -1;
-			}
+	return 1;
+}
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				if (update_gge(&m_if_2_oid, 5, i + 1, &pos, netinfo.if_speed[i]) == -1)
-					return -1;
-			}
+/*
+ * Binary search for the first MIB entry, at or after position lo, that is
+ * greater than or equal to (next: strictly greater than) the given OID.
+ * This relies on mib_build() creating the MIB in ascending OID order.
+ */
+static size_t mib_search(const value_t *mib, size_t length, const oid_t *oid, size_t lo, int next)
+{
+	size_t hi = length;
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				size_t len = sizeof(netinfo.mac_addr[i]);
-				char *mac = netinfo.mac_addr[i];
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int cmp;
 
-				if (mib_update_byte_array(&m_if_2_oid, 6, i + 1, &pos, mac, len))
-					return -1;
-			}
+		cmp = subid_cmp(mib[mid].oid.subid_list, mib[mid].oid.subid_list_length,
+				oid->subid_list, oid->subid_list_length);
+		if (cmp < 0 || (next && cmp == 0))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				unsigned int status = netinfo.status[i];
-				unsigned int updown = status != 2 ? 1 : 2;
+	return lo;
+}
 
-				if (update_int(&m_if_2_oid, 7, i + 1, &pos, updown) == -1)
-					return -1;
-			}
+/* Find the OID in the given MIB that is exactly the given one or a subid */
+static value_t *mib_lookup(value_t *mib, size_t length, const oid_t *oid, size_t *pos)
+{
+	size_t len = oid->subid_list_length * sizeof(oid->subid_list[0]);
+	value_t *curr;
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				if (update_int(&m_if_2_oid, 8, i + 1, &pos, netinfo.status[i]) == -1)
-					return -1;
-			}
+	/*
+	 * All entries having the given OID as prefix are sorted directly
+	 * after it, so the first entry not less than it is the only candidate
+	 */
+	*pos = mib_search(mib, length, oid, *pos, 0);
+	if (*pos >= length)
+		return NULL;
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				if (update_tm(&m_if_2_oid, 9, i + 1, &pos, netinfo.lastchange[i]) == -1)
-					return -1;
-			}
+	curr = &mib[*pos];
+	if (curr->oid.subid_list_length >= oid->subid_list_length &&
+	    !memcmp(curr->oid.subid_list, oid->subid_list, len))
+		return curr;
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				if (update_cnt(&m_if_2_oid, 10, i + 1, &pos, netinfo.rx_bytes[i] % UINT_MAX) == -1)
-					return -1;
-			}
+	return NULL;
+}
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				if (update_cnt(&m_if_2_oid, 11, i + 1, &pos, netinfo.rx_packets[i] % UINT_MAX) == -1)
-					return -1;
-			}
+/* Find the OID in the MIB being updated, as opposed to the one served */
+static value_t *mib_lookup_update(const oid_t *oid, size_t *pos)
+{
+	return mib_lookup(g_mib, g_mib_length, oid, pos);
+}
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				if (update_cnt(&m_if_2_oid, 13, i + 1, &pos, netinfo.rx_drops[i] % UINT_MAX) == -1)
-					return -1;
-			}
+#ifdef CONFIG_ENABLE_THREADS
+/*
+ * With the background collector, mib_update() runs in a thread of its own
+ * on g_mib, which is then copied to one of two snapshots and published.
+ * Request handling pins the published snapshot in mib_acquire(), so the
+ * lock is only ever held for a pointer update and a slow refresh of the
+ * MIB never delays a request.  The settings checked by requests are
+ * published with it, since the collector also reloads the configuration.
+ */
+static struct mib_snapshot {
+	value_t     *value;
+	size_t       length;
+	struct arena arena;
+	unsigned int layout;	/* Of g_mib when created */
+	int          readers;
+	char        *community;
+	int          auth;
+} m_snapshot[2];
+
+static struct mib_snapshot *m_current;
+static THREAD_LOCAL struct mib_snapshot *m_pinned;
+
+static pthread_mutex_t m_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  m_cond = PTHREAD_COND_INITIALIZER;
+#endif
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				if (update_cnt(&m_if_2_oid, 14, i + 1, &pos, netinfo.rx_errors[i] % UINT_MAX) == -1)
-					return -1;
-			}
+/* The MIB served by mib_find() and friends, set up by mib_acquire() */
+static THREAD_LOCAL value_t *m_view;
+static THREAD_LOCAL size_t   m_view_length;
+static THREAD_LOCAL int      m_view_depth;	/* Nested, e.g. for a batch of requests */
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				if (update_cnt(&m_if_2_oid, 16, i + 1, &pos, netinfo.tx_bytes[i] % UINT_MAX) == -1)
-					return -1;
-			}
+#ifdef CONFIG_ENABLE_THREADS
+/*
+ * Copy the values of the MIB to a snapshot of the same layout, only the
+ * values changed since the snapshot was last published, unless all
+ */
+static int mib_copy(struct mib_snapshot *snap, int all)
+{
+	size_t i;
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				if (update_cnt(&m_if_2_oid, 17, i + 1, &pos, netinfo.tx_packets[i] % UINT_MAX) == -1)
-					return -1;
-			}
+	for (i = 0; i < snap->length; i++) {
+		data_t *src = &g_mib[i].data;
+		data_t *dst = &snap->value[i].data;
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				if (update_cnt(&m_if_2_oid, 19, i + 1, &pos, netinfo.tx_drops[i] % UINT_MAX) == -1)
-					return -1;
-			}
+		if (!all && snap->value[i].generation == g_mib[i].generation)
+			continue;
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				if (update_cnt(&m_if_2_oid, 20, i + 1, &pos, netinfo.tx_errors[i] % UINT_MAX) == -1)
-					return -1;
-			}
+		if (dst->max_length < (size_t)src->encoded_length &&
+		    data_resize(&snap->arena, dst, src->max_length)) {
+			logit(LOG_ERR, errno, "Failed copying MIB value '%s'", mib_oid_ntoa(&g_mib[i].oid));
+			return -1;
 		}
-	}
 
-	/*
-	 * IP-MIB
-	 */
-	if (full) {
-		get_ipinfo(&u.ipinfo);
+		memcpy(dst->buffer, src->buffer, src->encoded_length);
+		dst->encoded_length = src->encoded_length;
+		snap->value[i].generation = g_mib[i].generation;
+		value_varbind(&snap->value[i]);
+	}
 
-		if (update_int(&m_ip_oid,  1, 0, &pos, u.ipinfo.ipForwarding)   == -1 ||
-		    update_int(&m_ip_oid,  2, 0, &pos, u.ipinfo.ipDefaultTTL)   == -1 ||
-		    update_int(&m_ip_oid, 13, 0, &pos, u.ipinfo.ipReasmTimeout) == -1 )
-			return -1;
+	return 0;
+}
 
-	}
+/*
+ * A snapshot has its own copy of the OIDs, since entries may be added to
+ * or removed from g_mib while a snapshot is still being served
+ */
+static int mib_snapshot_init(struct mib_snapshot *snap)
+{
+	size_t i;
 
-	/*
-	 * TCP-MIB
-	 */
-	if (full) {
-		get_tcpinfo(&u.tcpinfo);
-
-		if (update_int(&m_tcp_oid,  1, 0, &pos, u.tcpinfo.tcpRtoAlgorithm) == -1 ||
-		    update_int(&m_tcp_oid,  2, 0, &pos, u.tcpinfo.tcpRtoMin)       == -1 ||
-		    update_int(&m_tcp_oid,  3, 0, &pos, u.tcpinfo.tcpRtoMax)       == -1 ||
-		    update_int(&m_tcp_oid,  4, 0, &pos, u.tcpinfo.tcpMaxConn)      == -1 ||
-		    update_cnt(&m_tcp_oid,  5, 0, &pos, u.tcpinfo.tcpActiveOpens)  == -1 ||
-		    update_cnt(&m_tcp_oid,  6, 0, &pos, u.tcpinfo.tcpPassiveOpens) == -1 ||
-		    update_cnt(&m_tcp_oid,  7, 0, &pos, u.tcpinfo.tcpAttemptFails) == -1 ||
-		    update_cnt(&m_tcp_oid,  8, 0, &pos, u.tcpinfo.tcpEstabResets)  == -1 ||
-		    update_gge(&m_tcp_oid,  9, 0, &pos, u.tcpinfo.tcpCurrEstab)    == -1 ||
-		    update_cnt(&m_tcp_oid, 10, 0, &pos, u.tcpinfo.tcpInSegs)       == -1 ||
-		    update_cnt(&m_tcp_oid, 11, 0, &pos, u.tcpinfo.tcpOutSegs)      == -1 ||
-		    update_cnt(&m_tcp_oid, 12, 0, &pos, u.tcpinfo.tcpRetransSegs)  == -1 ||
-		    update_cnt(&m_tcp_oid, 14, 0, &pos, u.tcpinfo.tcpInErrs)       == -1 ||
-		    update_cnt(&m_tcp_oid, 15, 0, &pos, u.tcpinfo.tcpOutRsts)      == -1)
-			return -1;
-	}
+	snap->value = calloc(g_mib_length + 1, sizeof(value_t));
+	if (!snap->value)
+		return -1;
 
-	/*
-	 * UDP-MIB
-	 */
-	if (full) {
-		get_udpinfo(&u.udpinfo);
-
-		if (update_cnt(&m_udp_oid,  1, 0, &pos, u.udpinfo.udpInDatagrams & 0xFFFFFFFF)  == -1 ||
-		    update_cnt(&m_udp_oid,  2, 0, &pos, u.udpinfo.udpNoPorts)                   == -1 ||
-		    update_cnt(&m_udp_oid,  3, 0, &pos, u.udpinfo.udpInErrors)                  == -1 ||
-		    update_cnt(&m_udp_oid,  4, 0, &pos, u.udpinfo.udpOutDatagrams & 0xFFFFFFFF) == -1 ||
-		    update_c64(&m_udp_oid,  8, 0, &pos, u.udpinfo.udpInDatagrams)               == -1 ||
-		    update_c64(&m_udp_oid,  9, 0, &pos, u.udpinfo.udpOutDatagrams)              == -1)
-			return -1;
+	for (i = 0; i < g_mib_length; i++) {
+		snap->value[i].oid             = g_mib[i].oid;
+		snap->value[i].data.max_length = g_mib[i].data.max_length;
 	}
+	snap->length = g_mib_length;
+	snap->layout = m_layout;
 
-	/*
-	 * The host MIB: additional host info (HOST-RESOURCES-MIB.txt)
-	 * Caution: on changes, adapt the corresponding mib_build() section too!
-	 */
-	if (update_tm(&m_host_oid, 1, 0, &pos, get_system_uptime()) == -1)
+	if (arena_pack(&snap->arena, snap->value, snap->length, 1))
 		return -1;
 
-	/*
-	 * IF-MIB
-	 * ifXTable
-	 */
-	if (full) {
-		if (g_interface_list_length > 0) {
-			long long val;
-
-			for (i = 0; i < g_interface_list_length; i++) {
-				unsigned int packets = netinfo.rx_mc_packets[i] % UINT_MAX;
+	return mib_copy(snap, 1);
+}
 
-				if (update_cnt(&m_ifxtable_oid, 2, i + 1, &pos, packets) == -1)
-					return -1;
-			}
+static void mib_snapshot_free(struct mib_snapshot *snap)
+{
+	size_t i;
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				unsigned int packets = netinfo.rx_bc_packets[i] % UINT_MAX;
+	for (i = 0; i < snap->length; i++) {
+		if (!in_arena(&snap->arena, snap->value[i].data.buffer))
+			free(snap->value[i].data.buffer);
+	}
+	free(snap->community);
 
-				if (update_cnt(&m_ifxtable_oid, 3, i + 1, &pos, packets) == -1)
-					return -1;
-			}
+	free(snap->value);
+	free(snap->arena.base);
+	memset(snap, 0, sizeof(*snap));
+}
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				unsigned int packets = netinfo.tx_mc_packets[i] % UINT_MAX;
+/* Copy the settings of the requests, g_community is replaced on reload */
+static int mib_snapshot_settings(struct mib_snapshot *snap)
+{
+	if (!snap->community || strcmp(snap->community, g_community)) {
+		char *community;
 
-				if (update_cnt(&m_ifxtable_oid, 4, i + 1, &pos, packets) == -1)
-					return -1;
-			}
+		community = strdup(g_community);
+		if (!community)
+			return -1;
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				unsigned int packets = netinfo.tx_bc_packets[i] % UINT_MAX;
+		free(snap->community);
+		snap->community = community;
+	}
+	snap->auth = g_auth;
 
-				if (update_cnt(&m_ifxtable_oid, 5, i + 1, &pos, packets) == -1)
-					return -1;
-			}
+	return 0;
+}
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				val = (netinfo.rx_bytes[i] & 0xBFFFFFFFFFFFFFFFULL);
-				if (update_c64(&m_ifxtable_oid, 6, i + 1, &pos, val) == -1)
-					return -1;
-			}
+/* Publish the updated MIB in the snapshot not currently served */
+static int mib_publish(void)
+{
+	struct mib_snapshot *next;
+
+	pthread_mutex_lock(&m_lock);
+	next = (m_current == &m_snapshot[0]) ? &m_snapshot[1] : &m_snapshot[0];
+	while (next->readers)
+		pthread_cond_wait(&m_cond, &m_lock);
+	pthread_mutex_unlock(&m_lock);
+
+	/* New readers only pin m_current, so next is ours until published */
+	if (next->layout != m_layout) {
+		mib_snapshot_free(next);
+		if (mib_snapshot_init(next))
+			return -1;
+	} else if (mib_copy(next, 0)) {
+		return -1;
+	}
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				val = (netinfo.rx_packets[i] & 0xBFFFFFFFFFFFFFFFULL);
-				if (update_c64(&m_ifxtable_oid, 7, i + 1, &pos, val) == -1)
-					return -1;
-			}
+	if (mib_snapshot_settings(next))
+		return -1;
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				val = (netinfo.rx_mc_packets[i] & 0xBFFFFFFFFFFFFFFFULL);
-				if (update_c64(&m_ifxtable_oid, 8, i + 1, &pos, val) == -1)
-					return -1;
-			}
+	pthread_mutex_lock(&m_lock);
+	m_current = next;
+	pthread_mutex_unlock(&m_lock);
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				val = (netinfo.rx_bc_packets[i] & 0xBFFFFFFFFFFFFFFFULL);
-				if (update_c64(&m_ifxtable_oid, 9, i + 1, &pos, val) == -1)
-					return -1;
-			}
+	return 0;
+}
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				val = (netinfo.tx_bytes[i] & 0xBFFFFFFFFFFFFFFFULL);
-				if (update_c64(&m_ifxtable_oid, 10, i + 1, &pos, val) == -1)
-					return -1;
-			}
+static void *mib_collector(void *UNUSED(arg))
+{
+	unsigned long long last = 0;
+	struct pollfd pfd;
+	int ticks, rc;
+
+	/* Link changes wake us up early, a negative fd is ignored by poll() */
+	pfd.fd     = netlink_event_open();
+	pfd.events = POLLIN;
+
+	while (!g_quit) {
+		/*
+		 * SIGHUP is caught by the main thread, the MIB is ours to reload.
+		 * Checked before waiting, so link changes cannot postpone it, all
+		 * groups are then due and published right after.
+		 */
+		if (g_reload) {
+			g_reload = 0;
+			if (config_reload() == -1)
+				exit(EXIT_SYSCALL);
+		}
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				val = (netinfo.tx_packets[i] & 0xBFFFFFFFFFFFFFFFULL);
-				if (update_c64(&m_ifxtable_oid, 11, i + 1, &pos, val) == -1)
-					return -1;
+		/* Groups refreshed on every request are refreshed every g_timeout here */
+		ticks = mib_timeout();
+		if (ticks > g_timeout)
+			ticks = g_timeout;
+
+		/*
+		 * Link changes are published right away, and the refresh follows
+		 * if due, or a steady stream of them would postpone it forever
+		 */
+		if (poll(&pfd, 1, ticks * 10) > 0 && (pfd.revents & POLLIN)) {
+			rc = mib_link_event();
+			if (rc == -1)
+				exit(EXIT_SYSCALL);
+			if (mib_timeout() > 0 && mib_ticks() - last < (unsigned long long)g_timeout) {
+				if (rc > 0 && mib_publish())
+					logit(LOG_WARNING, 0, "Failed publishing MIB, serving previous values");
+				continue;
 			}
+		}
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				val = (netinfo.tx_mc_packets[i] & 0xBFFFFFFFFFFFFFFFULL);
-				if (update_c64(&m_ifxtable_oid, 12, i + 1, &pos, val) == -1)
-					return -1;
-			}
+		logit(LOG_DEBUG, 0, "updating the MIB (collector)");
+		if (mib_update(0) == -1)
+			exit(EXIT_SYSCALL);
+		last = mib_ticks();
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				val = (netinfo.tx_bc_packets[i] & 0xBFFFFFFFFFFFFFFFULL);
-				if (update_c64(&m_ifxtable_oid, 13, i + 1, &pos, val) == -1)
-					return -1;
-			}
+		if (mib_publish())
+			logit(LOG_WARNING, 0, "Failed publishing MIB, serving previous values");
+	}
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				if (update_gge(&m_ifxtable_oid, 15, i + 1, &pos, netinfo.if_speed[i] / 1000000) == -1)
-					return -1;
-			}
+	return NULL;
+}
 
-#if 0 // Not yet supported
-			for (i = 0; i < g_interface_list_length; i++) {
-				int ifConnectorPresent = netinfo.is_port[i] ? 1 : 2; /* XXX: Add support for ethtool on Linux */
+/* Start refreshing the MIB in the background, call after mib_build() */
+int mib_collector_start(void)
+{
+	pthread_attr_t attr;
+	sigset_t set, old;
+	pthread_t tid;
+	int rc;
+
+	if (mib_snapshot_init(&m_snapshot[0]) || mib_snapshot_init(&m_snapshot[1]) ||
+	    mib_snapshot_settings(&m_snapshot[0])) {
+		logit(LOG_ERR, errno, "Failed allocating MIB snapshots");
+		return -1;
+	}
+	m_current = &m_snapshot[0];
+
+	/* Signals must interrupt the main loop, so the thread inherits a full mask */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &old);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	rc = pthread_create(&tid, &attr, mib_collector, NULL);
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (rc) {
+		logit(LOG_ERR, rc, "Failed starting MIB collector thread");
+		m_current = NULL;
+		return -1;
+	}
 
-				if (update_int(&m_ifxtable_oid, 17, i + 1, &pos, ifConnectorPresent) == -1)
-					return -1;
-			}
+	return 0;
+}
+#endif /* CONFIG_ENABLE_THREADS */
 
-			for (i = 0; i < g_interface_list_length; i++) {
-				if (update_tm(&m_ifxtable_oid, 19, i + 1, &pos, netinfo.discont_time[i]) == -1)
-					return -1;
-			}
-#endif
-		}
-	}
+/* Pin the MIB to serve for the duration of a request, or batch of requests */
+void mib_acquire(void)
+{
+	if (m_view_depth++)
+		return;
 
 	/*
-	 * The memory MIB: total/free memory (UCD-SNMP-MIB.txt)
-	 * Caution: on changes, adapt the corresponding mib_build() section too!
+	 * In lazy mode nothing else discovers the interfaces, and it is safe
+	 * here.  The groups served are refreshed from one sample per request.
 	 */
-	if (full) {
-		get_meminfo(&u.meminfo);
-		if (update_int(&m_memory_oid,  5, 0, &pos, u.meminfo.total)   == -1 ||
-		    update_int(&m_memory_oid,  6, 0, &pos, u.meminfo.free)    == -1 ||
-		    update_int(&m_memory_oid, 13, 0, &pos, u.meminfo.shared)  == -1 ||
-		    update_int(&m_memory_oid, 14, 0, &pos, u.meminfo.buffers) == -1 ||
-		    update_int(&m_memory_oid, 15, 0, &pos, u.meminfo.cached)  == -1)
-			return -1;
+	if (g_lazy) {
+		cache_flush();
+		if (mib_discover(mib_ticks(), 0) < 0)
+			logit(LOG_WARNING, 0, "Failed discovering interfaces and disks");
 	}
 
-	/*
-	 * The disk MIB: mounted partitions (UCD-SNMP-MIB.txt)
-	 * Caution: on changes, adapt the corresponding mib_build() section too!
-	 */
-	if (full) {
-		if (g_disk_list_length > 0) {
-			get_diskinfo(&u.diskinfo);
-			for (i = 0; i < g_disk_list_length; i++) {
-				if (update_int(&m_disk_oid, 6, i + 1, &pos, u.diskinfo.total[i]) == -1)
-					return -1;
-			}
+#ifdef CONFIG_ENABLE_THREADS
+	if (m_current) {
+		pthread_mutex_lock(&m_lock);
+		m_pinned = m_current;
+		m_pinned->readers++;
+		pthread_mutex_unlock(&m_lock);
 
-			for (i = 0; i < g_disk_list_length; i++) {
-				if (update_int(&m_disk_oid, 7, i + 1, &pos, u.diskinfo.free[i]) == -1)
-					return -1;
-			}
+		m_view        = m_pinned->value;
+		m_view_length = m_pinned->length;
+		return;
+	}
+#endif
+	m_view        = g_mib;
+	m_view_length = g_mib_length;
+}
 
-			for (i = 0; i < g_disk_list_length; i++) {
-				if (update_int(&m_disk_oid, 8, i + 1, &pos, u.diskinfo.used[i]) == -1)
-					return -1;
-			}
+/* The community and authentication setting of the requests, after mib_acquire() */
+const char *mib_community(void)
+{
+#ifdef CONFIG_ENABLE_THREADS
+	if (m_pinned)
+		return m_pinned->community;
+#endif
+	return g_community;
+}
 
-			for (i = 0; i < g_disk_list_length; i++) {
-				if (update_int(&m_disk_oid, 9, i + 1, &pos, u.diskinfo.blocks_used_percent[i]) == -1)
-					return -1;
-			}
+int mib_auth(void)
+{
+#ifdef CONFIG_ENABLE_THREADS
+	if (m_pinned)
+		return m_pinned->auth;
+#endif
+	return g_auth;
+}
 
-			for (i = 0; i < g_disk_list_length; i++) {
-				if (update_int(&m_disk_oid, 10, i + 1, &pos, u.diskinfo.inodes_used_percent[i]) == -1)
-					return -1;
-			}
-		}
+void mib_release(void)
+{
+	if (--m_view_depth)
+		return;
+
+#ifdef CONFIG_ENABLE_THREADS
+	if (m_pinned) {
+		pthread_mutex_lock(&m_lock);
+		if (--m_pinned->readers == 0)
+			pthread_cond_signal(&m_cond);
+		m_pinned = NULL;
+		pthread_mutex_unlock(&m_lock);
 	}
+#endif
+	m_view        = NULL;
+	m_view_length = 0;
+}
 
-	/*
-	 * The load MIB: CPU load averages (UCD-SNMP-MIB.txt)
-	 * Caution: on changes, adapt the corresponding mib_build() section too!
-	 */
-	if (full) {
-		get_loadinfo(&u.loadinfo);
-		for (i = 0; i < 3; i++) {
-			snprintf(nr, sizeof(nr), "%d.%02d", u.loadinfo.avg[i] / 100, u.loadinfo.avg[i] % 100);
-			if (update_str(&m_load_oid, 3, i + 1, &pos, nr) == -1)
-				return -1;
+/*
+ * Record the range of MIB entries of each group, for the lazy mode.  The
+ * range of a group includes the groups nested in it, see mib_served().
+ */
+static void mib_bind_groups(void)
+{
+	size_t i;
+
+	for (i = 0; i < NELEMS(m_group); i++) {
+		struct mib_group *grp = &m_group[i];
+		size_t pos = 0;
+
+		grp->first = grp->end = mib_search(g_mib, g_mib_length, grp->oid, 0, 0);
+		while (mib_lookup(g_mib, g_mib_length, grp->oid, &pos) && pos == grp->end)
+			pos = ++grp->end;
+	}
+}
+
+/*
+ * Bind the columns to the slots of their entries in g_mib, so updates do
+ * not have to search for them.  A column with other entries between its
+ * rows is left unbound, and its entries are searched for instead.
+ */
+static void mib_bind_slots(void)
+{
+	size_t i, j;
+
+	for (i = 0; i < NELEMS(m_column); i++) {
+		const struct mib_column *col = &m_column[i];
+		size_t len = col->oid->subid_list_length;
+		size_t pos = 0;
+		oid_t oid;
+
+		m_column_slot[i].bound = 0;
+		if (!column_rows(col) ||
+		    oid_build(&oid, col->oid, col->column, column_row(col, 0)) ||
+		    !mib_lookup_update(&oid, &pos))
+			continue;
+
+		for (j = 0; j < column_rows(col) && pos + j < g_mib_length; j++) {
+			const mib_oid_t *entry = &g_mib[pos + j].oid;
+
+			if (entry->subid_list_length != len + 2 ||
+			    memcmp(entry->subid_list, col->oid->subid_list, len * sizeof(entry->subid_list[0])) ||
+			    entry->subid_list[len] != (unsigned int)col->column ||
+			    entry->subid_list[len + 1] != (unsigned int)column_row(col, j))
+				break;
 		}
 
-		for (i = 0; i < 3; i++) {
-			if (update_int(&m_load_oid, 5, i + 1, &pos, u.loadinfo.avg[i]) == -1)
-				return -1;
+		if (j == column_rows(col)) {
+			m_column_slot[i].slot  = pos;
+			m_column_slot[i].bound = j;
 		}
 	}
+}
 
-	/*
-	 * The cpu MIB: CPU statistics (UCD-SNMP-MIB.txt)
-	 * Caution: on changes, adapt the corresponding mib_build() section too!
-	 */
-	if (full) {
-		get_cpuinfo(&u.cpuinfo);
-		if (update_cnt(&m_cpu_oid, 50, 0, &pos, u.cpuinfo.user)   == -1 ||
-		    update_cnt(&m_cpu_oid, 51, 0, &pos, u.cpuinfo.nice)   == -1 ||
-		    update_cnt(&m_cpu_oid, 52, 0, &pos, u.cpuinfo.system) == -1 ||
-		    update_cnt(&m_cpu_oid, 53, 0, &pos, u.cpuinfo.idle)   == -1 ||
-		    update_cnt(&m_cpu_oid, 59, 0, &pos, u.cpuinfo.irqs)   == -1 ||
-		    update_cnt(&m_cpu_oid, 60, 0, &pos, u.cpuinfo.cntxts) == -1)
-			return -1;
+/*
+ * In lazy mode the MIB is not refreshed periodically, instead the group
+ * of each entry served is refreshed if its interval has passed.  So only
+ * the backends of the subtrees requested are ever run.
+ */
+static value_t *mib_served(size_t pos)
+{
+	struct mib_group *grp = NULL;
+	size_t i;
+
+	if (!g_lazy)
+		return &m_view[pos];
+
+	/* The innermost group of the entry, see m_group[] */
+	for (i = 0; i < NELEMS(m_group); i++) {
+		if (pos < m_group[i].first || pos >= m_group[i].end)
+			continue;
+
+		if (!grp || m_group[i].oid->subid_list_length > grp->oid->subid_list_length)
+			grp = &m_group[i];
 	}
 
-	/*
-	 * The demo MIB: two random integers (note: the random number is only
-	 * updated every "g_timeout" seconds; if you want it updated every SNMP
-	 * request, remove the enclosing "if" block).
-	 * Caution: on changes, adapt the corresponding mib_build() section too!
-	 */
-#ifdef CONFIG_ENABLE_DEMO
-	if (full) {
-		get_demoinfo(&u.demoinfo);
-		if (update_int(&m_demo_oid, 1, 0, &pos, u.demoinfo.random_value_1) == -1 ||
-		    update_int(&m_demo_oid, 2, 0, &pos, u.demoinfo.random_value_2) == -1)
-			return -1;
+	if (grp) {
+		m_in_request = 1;
+		if (group_update(grp, mib_ticks(), 0))
+			logit(LOG_WARNING, 0, "Failed refreshing MIB group %s", grp->name);
+		m_in_request = 0;
 	}
-#endif
 
-	return 0;
+	return &m_view[pos];
 }
 
 /* Find the OID in the MIB that is exactly the given one or a subid */
 value_t *mib_find(const oid_t *oid, size_t *pos)
 {
-	while (*pos < g_mib_length) {
-		value_t *curr = &g_mib[*pos];
-		size_t len = oid->subid_list_length * sizeof(oid->subid_list[0]);
-
-		if (curr->oid.subid_list_length >= oid->subid_list_length &&
-		    !memcmp(curr->oid.subid_list, oid->subid_list, len))
-			return curr;
-		*pos = *pos + 1;
-	}
+	if (!mib_lookup(m_view, m_view_length, oid, pos))
+		return NULL;
 
-	return NULL;
+	return mib_served(*pos);
 }
 
 /* Find the OID in the MIB that is the one after the given one */
-value_t *mib_findnext(const oid_t *oid)
+value_t *mib_findnext(const oid_t *oid, size_t *pos)
 {
-	size_t pos;
+	*pos = mib_search(m_view, m_view_length, oid, *pos, 1);
+	if (*pos >= m_view_length)
+		return NULL;
 
-	for (pos = 0; pos < g_mib_length; pos++) {
-		if (oid_cmp(&g_mib[pos].oid, oid) > 0)
-			return &g_mib[pos];
-	}
+	return mib_served(*pos);
+}
 
-	return NULL;
+/* Advance a position returned by mib_findnext() to the following OID */
+value_t *mib_next(size_t *pos)
+{
+	if (*pos < m_view_length)
+		*pos = *pos + 1;
+	if (*pos >= m_view_length)
+		return NULL;
+
+	return mib_served(*pos);
 }
 
 /* vim: ts=4 sts=4 sw=4 nowrap
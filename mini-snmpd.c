@@ -21,6 +21,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
 #include <net/if.h>
 #include <arpa/inet.h>
@@ -38,6 +39,10 @@
 #include <grp.h>
 
 #include "mini-snmpd.h"
+#ifdef CONFIG_ENABLE_THREADS
+#include <pthread.h>
+#include <poll.h>
+#endif
 
 static int usage(int rc)
 {
@@ -50,24 +55,33 @@ static int usage(int rc)
 	       "  -a, --auth             Enable authentication, i.e. SNMP version 2c\n"
 	       "  -c, --community STR    Community string, default: public\n"
 	       "  -C, --contact STR      System contact, default: none\n"
-	       "  -d, --disks PATH       Disks to monitor, default: /\n"
+	       "  -d, --disks PATH       Disks to monitor, or mount point patterns, default: /\n"
 	       "  -D, --description STR  System description, default: none\n"
 #ifdef HAVE_LIBCONFUSE
 	       "  -f, --file FILE        Configuration file. Default: " SYSCONFDIR "/%s.conf\n"
 #endif
 	       "  -h, --help             This help text\n"
-	       "  -i, --interfaces IFACE Network interfaces to monitor, default: none\n"
+	       "  -i, --interfaces IFACE Network interfaces to monitor, or patterns, default: none\n"
 	       "  -I, --listen IFACE     Network interface to listen, default: all\n"
 	       "  -l, --loglevel LEVEL   Set log level: none, err, info, notice*, debug\n"
 	       "  -L, --location STR     System location, default: none\n"
+	       "  -m, --max-clients NUM  Maximum number of TCP clients, default: 1024\n"
 	       "  -n, --foreground       Run in foreground, do not detach from controlling terminal\n"
 	       "  -p, --udp-port PORT    UDP port to bind to, default: 161\n"
 	       "  -P, --tcp-port PORT    TCP port to bind to, default: 161\n"
+#ifdef CONFIG_ENABLE_RATES
+	       "  -r, --rates SEC[,SEC]  Windows of the interface rates, default: 60,300,900\n"
+#endif
 	       "  -s, --syslog           Use syslog for logging, even if running in the foreground\n"
 	       "  -t, --timeout SEC      Timeout for MIB updates, default: 1 second\n"
 	       "  -u, --drop-privs USER  Drop privileges after opening sockets to USER, default: no\n"
 	       "  -v, --version          Show program version and exit\n"
 	       "  -V, --vendor OID       System vendor, default: none\n"
+#ifdef CONFIG_ENABLE_THREADS
+	       "  -w, --workers NUM      Number of threads serving UDP requests, default: 1\n"
+#else
+	       "  -z, --lazy             Refresh MIB groups only when requested, not periodically\n"
+#endif
 	       "\n", g_prognm
 #ifdef HAVE_LIBCONFUSE
 	       , PACKAGE_NAME
@@ -81,117 +95,310 @@ static int usage(int rc)
 	return rc;
 }
 
-static void handle_signal(int UNUSED(signo))
+#ifdef CONFIG_ENABLE_RATES
+/* The windows of the interface rates, in seconds, e.g. "10,60" */
+static int rate_windows(const char *arg)
 {
-	g_quit = 1;
+	char **list;
+	size_t i, len;
+	int rc = 0;
+
+	len = split(arg, ",;", &list);
+	for (i = 0; i < len; i++) {
+		if (!rc && rate_window(g_rate_window, i, atol(list[i])))
+			rc = -1;
+		free(list[i]);
+	}
+	free(list);
+
+	return rc;
 }
+#endif
+
+#ifdef HAVE_LIBCONFUSE
+static char  path[256] = "";
+static char *config = NULL;
+#endif
 
-static void handle_udp_client(void)
+static void handle_signal(int signo)
 {
-	const char *req_msg = "Failed UDP request from";
-	const char *snd_msg = "Failed UDP response to";
-	my_sockaddr_t sockaddr;
-	my_socklen_t socklen;
-	ssize_t rv;
-	char straddr[my_inet_addrstrlen] = { 0 };
+	if (signo == SIGHUP)
+		g_reload = 1;
+	else
+		g_quit = 1;
+}
 
-	memset(&sockaddr, 0, sizeof(sockaddr));
+/* Defaults of the settings not given on the command line or in the .conf file */
+static void set_defaults(void)
+{
+	if (!g_community)
+		g_community = "public";
+	if (!g_vendor)
+		g_vendor = VENDOR;
+	if (!g_description)
+		g_description = "";
+	if (!g_location)
+		g_location = "";
+	if (!g_contact)
+		g_contact = "";
+}
 
-	/* Read the whole UDP packet from the socket at once */
-	socklen = sizeof(sockaddr);
-	rv = recvfrom(g_udp_sockfd, g_udp_client.packet, sizeof(g_udp_client.packet),
-		      0, (struct sockaddr *)&sockaddr, &socklen);
-	if (rv == -1) {
-		logit(LOG_WARNING, errno, "Failed receiving UDP request on port %d", g_udp_port);
+/*
+ * Read the .conf file again, on SIGHUP, and apply it to the MIB in place,
+ * so clients, TCP sessions and counters carry on as before.  With threads
+ * this is done by the collector, which owns the MIB, and the settings the
+ * requests check are published with the MIB.  The lazy mode, number of
+ * workers and maximum number of clients are only read at startup.
+ */
+int config_reload(void)
+{
+#ifdef HAVE_LIBCONFUSE
+	logit(LOG_NOTICE, 0, "Reloading %s", config);
+
+	if (read_config(config, 1)) {
+		logit(LOG_WARNING, 0, "Failed reloading %s, keeping previous settings", config);
+		return 0;
+	}
+
+	set_defaults();
+#else
+	logit(LOG_NOTICE, 0, "Reloading, discovering interfaces and disks again");
+#endif
+
+	return mib_reload();
+}
+
+#ifndef CONFIG_ENABLE_THREADS
+/*
+ * Re-arm the MIB refresh timer for the next group due, if it has expired
+ * or that group is due at another time than the timer was armed for, e.g.
+ * after a reload or a link change, which refreshes the interfaces group.
+ */
+static int timer_rearm(int expired)
+{
+	static unsigned long long armed;
+	unsigned long long due;
+	int ticks;
+
+	ticks = mib_timeout();
+	due   = mib_ticks() + ticks;
+	if (!expired && due == armed)
+		return 0;
+
+	armed = due;
+	return event_timer(ticks, &g_timeout);
+}
+#endif
+
+/*
+ * TCP clients are only reached by the events of their socket.  A client
+ * closed is kept off the free list until all events of the same
+ * event_wait() have been handled, so a later one for it finds sockfd -1
+ * instead of a new client.
+ */
+static client_t *tcp_closed;
+static client_t *tcp_free;
+static int       tcp_clients;
+
+static void client_close(client_t *client)
+{
+	close(client->sockfd);
+	client->sockfd = -1;
+	client->next = tcp_closed;
+	tcp_closed = client;
+	tcp_clients--;
+}
+
+/*
+ * Each TCP client has a descriptor of its own, raise the soft limit if it
+ * is too low for them besides the sockets, workers and files kept open
+ */
+static void client_limit(void)
+{
+	struct rlimit rl;
+	rlim_t num = (rlim_t)g_max_clients + 256;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) || rl.rlim_cur >= num)
 		return;
+
+	if (rl.rlim_max < num)
+		logit(LOG_WARNING, 0, "Limited to %llu open files, fewer than %d clients may connect",
+		      (unsigned long long)rl.rlim_max, g_max_clients);
+
+	rl.rlim_cur = MIN(num, rl.rlim_max);
+	if (setrlimit(RLIMIT_NOFILE, &rl))
+		logit(LOG_WARNING, errno, "Failed raising the limit of open files");
+}
+
+/* Make the clients closed while handling the last events available again */
+static void client_reap(void)
+{
+	while (tcp_closed) {
+		client_t *client = tcp_closed;
+
+		tcp_closed = client->next;
+		client->next = tcp_free;
+		tcp_free = client;
 	}
+}
 
-	g_udp_client.timestamp = time(NULL);
-	g_udp_client.sockfd = g_udp_sockfd;
-	g_udp_client.addr = sockaddr.my_sin_addr;
-	g_udp_client.port = sockaddr.my_sin_port;
-	g_udp_client.size = rv;
-	g_udp_client.outgoing = 0;
+/* Prepare the response, returns -1 if there is nothing to send */
+static int handle_udp_request(int sockfd, client_t *client, my_sockaddr_t *sockaddr)
+{
+	const char *req_msg = "Failed UDP request from";
+	char straddr[my_inet_addrstrlen] = { 0 };
+
+	client->timestamp = time(NULL);
+	client->sockfd = sockfd;
+	client->addr = sockaddr->my_sin_addr;
+	client->port = sockaddr->my_sin_port;
+	client->outgoing = 0;
 #ifdef DEBUG
-	dump_packet(&g_udp_client);
+	dump_packet(client);
 #endif
 
 	/* Call the protocol handler which will prepare the response packet */
-	inet_ntop(my_af_inet, &sockaddr.my_sin_addr, straddr, sizeof(straddr));
-	if (snmp(&g_udp_client) == -1) {
-		logit(LOG_WARNING, errno, "%s %s:%d", req_msg, straddr, sockaddr.my_sin_port);
-		return;
+	inet_ntop(my_af_inet, &sockaddr->my_sin_addr, straddr, sizeof(straddr));
+	if (snmp(client) == -1) {
+		logit(LOG_WARNING, errno, "%s %s:%d", req_msg, straddr, sockaddr->my_sin_port);
+		return -1;
 	}
-	if (g_udp_client.size == 0) {
-		logit(LOG_WARNING, 0, "%s %s:%d: ignored", req_msg, straddr, sockaddr.my_sin_port);
-		return;
+	if (client->size == 0) {
+		logit(LOG_WARNING, 0, "%s %s:%d: ignored", req_msg, straddr, sockaddr->my_sin_port);
+		return -1;
 	}
-	g_udp_client.outgoing = 1;
+	client->outgoing = 1;
 
-	/* Send the whole UDP packet to the socket at once */
-	rv = sendto(g_udp_sockfd, g_udp_client.packet, g_udp_client.size,
-		    MSG_DONTWAIT, (struct sockaddr *)&sockaddr, socklen);
-	inet_ntop(my_af_inet, &sockaddr.my_sin_addr, straddr, sizeof(straddr));
-	if (rv == -1)
-		logit(LOG_WARNING, errno, "%s %s:%d", snd_msg, straddr, sockaddr.my_sin_port);
-	else if ((size_t)rv != g_udp_client.size)
-		logit(LOG_WARNING, 0, "%s %s:%d: only %zd of %zu bytes sent", snd_msg, straddr, sockaddr.my_sin_port, rv, g_udp_client.size);
+	return 0;
+}
+
+/*
+ * Read up to MAX_NR_UDP_BATCH requests at once into the client buffers,
+ * answer them all from the same MIB and send all responses at once.
+ * Returns -1 when there are no more UDP packets to read.
+ */
+static int handle_udp_client(int sockfd, client_t *client)
+{
+	const char *snd_msg = "Failed UDP response to";
+	my_sockaddr_t sockaddr[MAX_NR_UDP_BATCH];
+	struct mmsghdr msg[MAX_NR_UDP_BATCH];
+	struct iovec iov[MAX_NR_UDP_BATCH];
+	char straddr[my_inet_addrstrlen] = { 0 };
+	int i, num, out = 0;
+
+	memset(sockaddr, 0, sizeof(sockaddr));
+	memset(msg, 0, sizeof(msg));
 
+	for (i = 0; i < MAX_NR_UDP_BATCH; i++) {
+		iov[i].iov_base = client[i].packet;
+		iov[i].iov_len  = sizeof(client[i].packet);
+
+		msg[i].msg_hdr.msg_name    = &sockaddr[i];
+		msg[i].msg_hdr.msg_namelen = sizeof(sockaddr[i]);
+		msg[i].msg_hdr.msg_iov     = &iov[i];
+		msg[i].msg_hdr.msg_iovlen  = 1;
+	}
+
+	/* Read each whole UDP packet from the socket at once */
+	num = recvmmsg(sockfd, msg, MAX_NR_UDP_BATCH, MSG_DONTWAIT, NULL);
+	if (num == -1) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			logit(LOG_WARNING, errno, "Failed receiving UDP request on port %d", g_udp_port);
+		return -1;
+	}
+
+	/* Responses are queued at the front of msg[], never ahead of the requests */
+	mib_acquire();
+	for (i = 0; i < num; i++) {
+		client[i].size = msg[i].msg_len;
+		if (handle_udp_request(sockfd, &client[i], &sockaddr[i]))
+			continue;
 #ifdef DEBUG
-	dump_packet(&g_udp_client);
+		dump_packet(&client[i]);
 #endif
+
+		iov[out].iov_base = client[i].packet;
+		iov[out].iov_len  = client[i].size;
+
+		msg[out].msg_hdr.msg_name    = &sockaddr[i];
+		msg[out].msg_hdr.msg_namelen = msg[i].msg_hdr.msg_namelen;
+		msg[out].msg_hdr.msg_iov     = &iov[out];
+		msg[out].msg_hdr.msg_iovlen  = 1;
+		out++;
+	}
+	mib_release();
+
+	/* Send each whole UDP packet to the socket at once, skip any failed */
+	for (i = 0; i < out; ) {
+		my_sockaddr_t *sa = msg[i].msg_hdr.msg_name;
+		int sent;
+
+		sent = sendmmsg(sockfd, &msg[i], out - i, MSG_DONTWAIT);
+		if (sent == -1) {
+			inet_ntop(my_af_inet, &sa->my_sin_addr, straddr, sizeof(straddr));
+			logit(LOG_WARNING, errno, "%s %s:%d", snd_msg, straddr, sa->my_sin_port);
+			i++;
+			continue;
+		}
+
+		for (sent += i; i < sent; i++) {
+			sa = msg[i].msg_hdr.msg_name;
+			if (msg[i].msg_len != iov[i].iov_len) {
+				inet_ntop(my_af_inet, &sa->my_sin_addr, straddr, sizeof(straddr));
+				logit(LOG_WARNING, 0, "%s %s:%d: only %u of %zu bytes sent", snd_msg,
+				      straddr, sa->my_sin_port, msg[i].msg_len, iov[i].iov_len);
+			}
+		}
+	}
+
+	/* A short batch drained the socket, later packets are new events */
+	return num < MAX_NR_UDP_BATCH ? -1 : 0;
 }
 
-static void handle_tcp_connect(void)
+/* Returns -1 when there are no more connections to accept */
+static int handle_tcp_connect(void)
 {
 	const char *msg = "Could not accept TCP connection";
-	my_sockaddr_t tmp_sockaddr;
 	my_sockaddr_t sockaddr;
 	my_socklen_t socklen;
 	client_t *client;
 	char straddr[my_inet_addrstrlen] = "";
 	int rv;
 
-	memset(&tmp_sockaddr, 0, sizeof(tmp_sockaddr));
 	memset(&sockaddr, 0, sizeof(sockaddr));
 
 	/* Accept the new connection (remember the client's IP address and port) */
 	socklen = sizeof(sockaddr);
 	rv = accept(g_tcp_sockfd, (struct sockaddr *)&sockaddr, &socklen);
 	if (rv == -1) {
-		logit(LOG_ERR, errno, "%s", msg);
-		return;
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			logit(LOG_ERR, errno, "%s", msg);
+		return -1;
 	}
-	if (rv >= FD_SETSIZE) {
-		logit(LOG_ERR, 0, "%s: FD set overflow", msg);
+	inet_ntop(my_af_inet, &sockaddr.my_sin_addr, straddr, sizeof(straddr));
+
+	/* At the limit new clients are turned away, the connected ones are kept */
+	if (tcp_clients >= g_max_clients) {
+		logit(LOG_WARNING, 0, "Maximum number of %d clients reached, rejecting %s:%d",
+		      g_max_clients, straddr, sockaddr.my_sin_port);
 		close(rv);
-		return;
+		return 0;
 	}
-
-	/* Create a new client control structure or overwrite the oldest one */
-	if (g_tcp_client_list_length >= MAX_NR_CLIENTS) {
-		client = find_oldest_client();
-		if (!client) {
-			logit(LOG_ERR, 0, "%s: internal error", msg);
-			exit(EXIT_SYSCALL);
-		}
-
-		tmp_sockaddr.my_sin_addr = client->addr;
-		tmp_sockaddr.my_sin_port = client->port;
-		inet_ntop(my_af_inet, &tmp_sockaddr.my_sin_addr, straddr, sizeof(straddr));
-		logit(LOG_WARNING, 0, "Maximum number of %d clients reached, kicking out %s:%d",
-		      MAX_NR_CLIENTS, straddr, tmp_sockaddr.my_sin_port);
-		close(client->sockfd);
-	} else {
-		client = allocate(sizeof(client_t));
-		if (!client)
-			exit(EXIT_SYSCALL);
-
-		g_tcp_client_list[g_tcp_client_list_length++] = client;
+	if (event_nonblock(rv)) {
+		logit(LOG_ERR, errno, "%s", msg);
+		close(rv);
+		return 0;
 	}
 
+	/* Reuse the control structure of a client closed before, if any */
+	client = tcp_free;
+	if (client)
+		tcp_free = client->next;
+	else if (!(client = allocate(sizeof(client_t))))
+		exit(EXIT_SYSCALL);
+	tcp_clients++;
+
 	/* Now fill out the client control structure values */
-	inet_ntop(my_af_inet, &sockaddr.my_sin_addr, straddr, sizeof(straddr));
 	logit(LOG_DEBUG, 0, "Connected TCP client %s:%d", straddr, sockaddr.my_sin_port);
 	client->timestamp = time(NULL);
 	client->sockfd = rv;
@@ -199,6 +406,11 @@ static void handle_tcp_connect(void)
 	client->port = sockaddr.my_sin_port;
 	client->size = 0;
 	client->outgoing = 0;
+
+	if (event_add(client->sockfd, client))
+		client_close(client);
+
+	return 0;
 }
 
 static void handle_tcp_client_write(client_t *client)
@@ -208,22 +420,25 @@ static void handle_tcp_client_write(client_t *client)
 	char straddr[my_inet_addrstrlen] = "";
 	my_sockaddr_t sockaddr;
 
+	if (client->sockfd == -1 || !client->outgoing)
+		return;
+
 	/* Send the packet atomically and close socket if that did not work */
 	sockaddr.my_sin_addr = client->addr;
 	sockaddr.my_sin_port = client->port;
 	rv = send(client->sockfd, client->packet, client->size, 0);
+	if (rv == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return;
 	inet_ntop(my_af_inet, &sockaddr.my_sin_addr, straddr, sizeof(straddr));
 	if (rv == -1) {
 		logit(LOG_WARNING, errno, "%s %s:%d", msg, straddr, sockaddr.my_sin_port);
-		close(client->sockfd);
-		client->sockfd = -1;
+		client_close(client);
 		return;
 	}
 	if ((size_t)rv != client->size) {
 		logit(LOG_WARNING, 0, "%s %s:%d: only %zd of %zu bytes written",
 		      msg, straddr, sockaddr.my_sin_port, rv, client->size);
-		close(client->sockfd);
-		client->sockfd = -1;
+		client_close(client);
 		return;
 	}
 
@@ -231,9 +446,11 @@ static void handle_tcp_client_write(client_t *client)
 	dump_packet(client);
 #endif
 
-	/* Put the client into listening mode again */
+	/* Put the client into listening mode again, reports any pending request */
 	client->size = 0;
 	client->outgoing = 0;
+	if (event_mod(client->sockfd, client, 0))
+		client_close(client);
 }
 
 static void handle_tcp_client_read(client_t *client)
@@ -243,38 +460,39 @@ static void handle_tcp_client_read(client_t *client)
 	char straddr[my_inet_addrstrlen] = "";
 	my_sockaddr_t sockaddr;
 
-	/* Read from the socket what arrived and put it into the buffer */
-	sockaddr.my_sin_addr = client->addr;
-	sockaddr.my_sin_port = client->port;
-	rv = read(client->sockfd, client->packet + client->size, sizeof(client->packet) - client->size);
-	inet_ntop(my_af_inet, &sockaddr.my_sin_addr, straddr, sizeof(straddr));
-	if (rv == -1) {
-		logit(LOG_WARNING, errno, "%s %s:%d", req_msg, straddr, sockaddr.my_sin_port);
-		close(client->sockfd);
-		client->sockfd = -1;
+	if (client->sockfd == -1 || client->outgoing)
 		return;
-	}
-	if (rv == 0) {
-		logit(LOG_DEBUG, 0, "TCP client %s:%d disconnected",
-		      straddr, sockaddr.my_sin_port);
-		close(client->sockfd);
-		client->sockfd = -1;
-		return;
-	}
-	client->timestamp = time(NULL);
-	client->size += rv;
 
-	/* Check whether the packet was fully received and handle packet if yes */
-	rv = snmp_packet_complete(client);
-	if (rv == -1) {
-		logit(LOG_WARNING, errno, "%s %s:%d", req_msg, straddr, sockaddr.my_sin_port);
-		close(client->sockfd);
-		client->sockfd = -1;
-		return;
-	}
-	if (rv == 0) {
-		return;
-	}
+	/* Read from the socket what arrived until a request is complete */
+	sockaddr.my_sin_addr = client->addr;
+	sockaddr.my_sin_port = client->port;
+	do {
+		rv = read(client->sockfd, client->packet + client->size, sizeof(client->packet) - client->size);
+		if (rv == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		inet_ntop(my_af_inet, &sockaddr.my_sin_addr, straddr, sizeof(straddr));
+		if (rv == -1) {
+			logit(LOG_WARNING, errno, "%s %s:%d", req_msg, straddr, sockaddr.my_sin_port);
+			client_close(client);
+			return;
+		}
+		if (rv == 0) {
+			logit(LOG_DEBUG, 0, "TCP client %s:%d disconnected",
+			      straddr, sockaddr.my_sin_port);
+			client_close(client);
+			return;
+		}
+		client->timestamp = time(NULL);
+		client->size += rv;
+
+		/* Check whether the packet was fully received and handle packet if yes */
+		rv = snmp_packet_complete(client);
+		if (rv == -1) {
+			logit(LOG_WARNING, errno, "%s %s:%d", req_msg, straddr, sockaddr.my_sin_port);
+			client_close(client);
+			return;
+		}
+	} while (rv == 0);
 	client->outgoing = 0;
 
 #ifdef DEBUG
@@ -284,20 +502,167 @@ static void handle_tcp_client_read(client_t *client)
 	/* Call the protocol handler which will prepare the response packet */
 	if (snmp(client) == -1) {
 		logit(LOG_WARNING, errno, "%s %s:%d", req_msg, straddr, sockaddr.my_sin_port);
-		close(client->sockfd);
-		client->sockfd = -1;
+		client_close(client);
 		return;
 	}
 	if (client->size == 0) {
 		logit(LOG_WARNING, 0, "%s %s:%d: ignored", req_msg, straddr, sockaddr.my_sin_port);
-		close(client->sockfd);
-		client->sockfd = -1;
+		client_close(client);
 		return;
 	}
 
+	/* Any further request is read after the response has been sent */
 	client->outgoing = 1;
+	if (event_mod(client->sockfd, client, 1))
+		client_close(client);
+}
+
+/* Open a UDP socket for requests, with workers each has one of its own */
+static int open_udp_socket(void)
+{
+	union {
+		struct sockaddr_in sa;
+#ifdef CONFIG_ENABLE_IPV6
+		struct sockaddr_in6 sa6;
+#endif
+	} sockaddr;
+	my_socklen_t socklen;
+#ifndef __FreeBSD__
+	struct ifreq ifreq;
+#endif
+	int sockfd;
+
+	sockfd = socket((g_family == AF_INET) ? PF_INET : PF_INET6, SOCK_DGRAM, 0);
+	if (sockfd == -1) {
+		logit(LOG_ERR, errno, "could not create UDP socket");
+		exit(EXIT_SYSCALL);
+	}
+
+#ifdef CONFIG_ENABLE_THREADS
+	/* The kernel spreads the requests over all sockets bound to the port */
+	if (g_workers > 1) {
+		int on = 1;
+
+		if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+			logit(LOG_ERR, errno, "could not set SO_REUSEPORT on UDP socket");
+			exit(EXIT_SYSCALL);
+		}
+	}
+#endif
+
+	memset(&sockaddr, 0, sizeof(sockaddr));
+	if (g_family == AF_INET) {
+		sockaddr.sa.sin_family = g_family;
+		sockaddr.sa.sin_port = htons(g_udp_port);
+		sockaddr.sa.sin_addr = inaddr_any;
+		socklen = sizeof(sockaddr.sa);
+#ifdef CONFIG_ENABLE_IPV6
+	} else {
+		sockaddr.sa6.sin6_family = g_family;
+		sockaddr.sa6.sin6_port = htons(g_udp_port);
+		sockaddr.sa6.sin6_addr = in6addr_any;
+		socklen = sizeof(sockaddr.sa6);
+#endif
+	}
+	if (bind(sockfd, (struct sockaddr *)&sockaddr, socklen) == -1) {
+		logit(LOG_ERR, errno, "could not bind UDP socket to port %d", g_udp_port);
+		exit(EXIT_SYSCALL);
+	}
+
+#ifndef __FreeBSD__
+	if (g_bind_to_device) {
+		snprintf(ifreq.ifr_ifrn.ifrn_name, sizeof(ifreq.ifr_ifrn.ifrn_name), "%s", g_bind_to_device);
+		if (setsockopt(sockfd, SOL_SOCKET, SO_BINDTODEVICE, (char *)&ifreq, sizeof(ifreq)) == -1) {
+			logit(LOG_WARNING, errno, "could not bind UDP socket to device %s", g_bind_to_device);
+			exit(EXIT_SYSCALL);
+		}
+	}
+#endif
+
+	return sockfd;
 }
 
+#ifdef CONFIG_ENABLE_THREADS
+/*
+ * With --workers N the first UDP socket is served by the main loop, the
+ * other N - 1 by a thread each, with buffers of its own.  All of them
+ * answer from the MIB published by the collector thread.
+ */
+struct udp_worker {
+	int       sockfd;
+	client_t  client[MAX_NR_UDP_BATCH];
+};
+
+static struct udp_worker *workers;
+
+static void *udp_worker(void *arg)
+{
+	struct udp_worker *worker = arg;
+	struct pollfd pfd;
+
+	pfd.fd     = worker->sockfd;
+	pfd.events = POLLIN;
+
+	while (!g_quit) {
+		if (poll(&pfd, 1, -1) <= 0)
+			continue;
+
+		while (!handle_udp_client(worker->sockfd, worker->client))
+			;
+	}
+
+	return NULL;
+}
+
+/* Open the sockets early, binding to port 161 needs root privileges */
+static int udp_workers_open(void)
+{
+	int i;
+
+	if (g_workers < 2)
+		return 0;
+
+	workers = allocate((g_workers - 1) * sizeof(*workers));
+	if (!workers)
+		return -1;
+
+	for (i = 0; i < g_workers - 1; i++)
+		workers[i].sockfd = open_udp_socket();
+
+	return 0;
+}
+
+static int udp_workers_start(void)
+{
+	pthread_attr_t attr;
+	sigset_t set, old;
+	pthread_t tid;
+	int i, rc = 0;
+
+	if (!workers)
+		return 0;
+
+	/* Signals must interrupt the main loop, so the threads inherit a full mask */
+	sigfillset(&set);
+	pthread_sigmask(SIG_SETMASK, &set, &old);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	for (i = 0; i < g_workers - 1; i++) {
+		rc = pthread_create(&tid, &attr, udp_worker, &workers[i]);
+		if (rc) {
+			logit(LOG_ERR, rc, "Failed starting UDP worker thread");
+			break;
+		}
+	}
+	pthread_attr_destroy(&attr);
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	return rc ? -1 : 0;
+}
+#endif /* CONFIG_ENABLE_THREADS */
+
 static int log_level(char *arg)
 {
 	int i, rc;
@@ -334,7 +699,7 @@ static char *progname(char *arg0)
 
 int main(int argc, char *argv[])
 {
-	static const char short_options[] = "ac:C:d:D:hi:l:L:np:P:st:u:vV:"
+	static const char short_options[] = "ac:C:d:D:hi:l:L:m:np:P:st:u:vV:"
 #ifndef __FreeBSD__
 		"I:"
 #endif
@@ -343,6 +708,14 @@ int main(int argc, char *argv[])
 #endif
 #ifdef HAVE_LIBCONFUSE
 		"f:"
+#endif
+#ifdef CONFIG_ENABLE_RATES
+		"r:"
+#endif
+#ifdef CONFIG_ENABLE_THREADS
+		"w:"
+#else
+		"z"
 #endif
 		;
 	static const struct option long_options[] = {
@@ -365,26 +738,34 @@ int main(int argc, char *argv[])
 #endif
 		{ "loglevel",    1, 0, 'l' },
 		{ "location",    1, 0, 'L' },
+		{ "max-clients", 1, 0, 'm' },
 		{ "foreground",  0, 0, 'n' },
 		{ "udp-port",    1, 0, 'p' },
 		{ "tcp-port",    1, 0, 'P' },
+#ifdef CONFIG_ENABLE_RATES
+		{ "rates",       1, 0, 'r' },
+#endif
 		{ "syslog",      0, 0, 's' },
 		{ "timeout",     1, 0, 't' },
 		{ "drop-privs",  1, 0, 'u' },
 		{ "version",     0, 0, 'v' },
 		{ "vendor",      1, 0, 'V' },
+#ifdef CONFIG_ENABLE_THREADS
+		{ "workers",     1, 0, 'w' },
+#else
+		{ "lazy",        0, 0, 'z' },
+#endif
 		{ NULL, 0, 0, 0 }
 	};
-	int ticks, nfds, c, option_index = 1;
-	size_t i;
-	fd_set rfds, wfds;
+	int num, c, option_index = 1;
+#ifndef CONFIG_ENABLE_THREADS
+	int link_sockfd, expired, reloaded, request;
+#endif
+	event_t event[MAX_NR_EVENTS];
 	struct sigaction sig;
 #ifndef __FreeBSD__
 	struct ifreq ifreq;
 #endif
-	struct timeval tv_last;
-	struct timeval tv_now;
-	struct timeval tv_sleep;
 	my_socklen_t socklen;
 	union {
 		struct sockaddr_in sa;
@@ -392,10 +773,6 @@ int main(int argc, char *argv[])
 		struct sockaddr_in6 sa6;
 #endif
 	} sockaddr;
-#ifdef HAVE_LIBCONFUSE
-	char path[256] = "";
-	char *config = NULL;
-#endif
 
 	g_prognm = progname(argv[0]);
 
@@ -428,7 +805,7 @@ int main(int argc, char *argv[])
 			break;
 
 		case 'd':
-			g_disk_list_length = split(optarg, ",:;", g_disk_list, MAX_NR_DISKS);
+			g_disk_glob_length = split(optarg, ",:;", &g_disk_glob);
 			break;
 
 		case 'D':
@@ -443,7 +820,7 @@ int main(int argc, char *argv[])
 			return usage(0);
 
 		case 'i':
-			g_interface_list_length = split(optarg, ",;", g_interface_list, MAX_NR_INTERFACES);
+			g_interface_glob_length = split(optarg, ",;", &g_interface_glob);
 			break;
 #ifndef __FreeBSD__
 		case 'I':
@@ -459,6 +836,10 @@ int main(int argc, char *argv[])
 			g_location = optarg;
 			break;
 
+		case 'm':
+			g_max_clients = atoi(optarg);
+			break;
+
 		case 'n':
 			g_daemon = 0;
 			break;
@@ -470,6 +851,12 @@ int main(int argc, char *argv[])
 		case 'P':
 			g_tcp_port = atoi(optarg);
 			break;
+#ifdef CONFIG_ENABLE_RATES
+		case 'r':
+			if (rate_windows(optarg))
+				return usage(1);
+			break;
+#endif
 
 		case 's':
 			g_syslog = 1;
@@ -490,6 +877,15 @@ int main(int argc, char *argv[])
 		case 'V':
 			g_vendor = optarg;
 			break;
+#ifdef CONFIG_ENABLE_THREADS
+		case 'w':
+			g_workers = atoi(optarg);
+			break;
+#else
+		case 'z':
+			g_lazy = 1;
+			break;
+#endif
 
 		default:
 			return usage(EXIT_ARGS);
@@ -509,6 +905,9 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/* In ticks from now on, read_config() converts the seconds of the .conf file */
+	g_timeout *= 100;
+
 #ifdef HAVE_LIBCONFUSE
 	if (!config) {
 		snprintf(path, sizeof(path), "%s/%s.conf", SYSCONFDIR, PACKAGE_NAME);
@@ -518,39 +917,38 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	if (read_config(config))
+	if (read_config(config, 0))
 		return 1;
 #endif
 
-	if (!g_community)
-		g_community = "public";
-	if (!g_vendor)
-		g_vendor = VENDOR;
-	if (!g_description)
-		g_description = "";
-	if (!g_location)
-		g_location = "";
-	if (!g_contact)
-		g_contact = "";
+	set_defaults();
 
-	g_timeout *= 100;
+	if (g_max_clients < 1) {
+		logit(LOG_ERR, 0, "Invalid maximum number of clients %d", g_max_clients);
+		return 1;
+	}
+	client_limit();
 
-	/* Store the starting time since we need it for MIB updates */
-	if (gettimeofday(&tv_last, NULL) == -1) {
-		memset(&tv_last, 0, sizeof(tv_last));
-		memset(&tv_sleep, 0, sizeof(tv_sleep));
-	} else {
-		tv_sleep.tv_sec = g_timeout / 100;
-		tv_sleep.tv_usec = (g_timeout % 100) * 10000;
+#ifdef CONFIG_ENABLE_THREADS
+	if (g_workers < 1 || g_workers > MAX_NR_WORKERS) {
+		logit(LOG_ERR, 0, "Invalid number of workers %d, valid range 1-%d", g_workers, MAX_NR_WORKERS);
+		return 1;
 	}
+#else
+	/* Subscribe to link changes, with threads this is up to the collector */
+	link_sockfd = netlink_event_open();
+#endif
 
-	/* Build the MIB and execute the first MIB update to get actual values */
+	/*
+	 * Build the MIB and execute the first MIB update to get actual values,
+	 * in lazy mode each group is updated on the first request for it.
+	 */
 	if (mib_build() == -1)
 		exit(EXIT_SYSCALL);
-	if (mib_update(1) == -1)
+	if (!g_lazy && mib_update(1) == -1)
 		exit(EXIT_SYSCALL);
 
-	/* Prevent TERM and HUP signals from interrupting system calls */
+	/* Prevent TERM and HUP signals from interrupting system calls, HUP reloads */
 	sig.sa_handler = handle_signal;
 	sigemptyset (&sig.sa_mask);
 	sig.sa_flags = SA_RESTART;
@@ -563,38 +961,10 @@ int main(int argc, char *argv[])
 #endif
 
 	/* Open the server's UDP port and prepare it for listening */
-	g_udp_sockfd = socket((g_family == AF_INET) ? PF_INET : PF_INET6, SOCK_DGRAM, 0);
-	if (g_udp_sockfd == -1) {
-		logit(LOG_ERR, errno, "could not create UDP socket");
+	g_udp_sockfd = open_udp_socket();
+#ifdef CONFIG_ENABLE_THREADS
+	if (udp_workers_open())
 		exit(EXIT_SYSCALL);
-	}
-
-	if (g_family == AF_INET) {
-		sockaddr.sa.sin_family = g_family;
-		sockaddr.sa.sin_port = htons(g_udp_port);
-		sockaddr.sa.sin_addr = inaddr_any;
-		socklen = sizeof(sockaddr.sa);
-#ifdef CONFIG_ENABLE_IPV6
-	} else {
-		sockaddr.sa6.sin6_family = g_family;
-		sockaddr.sa6.sin6_port = htons(g_udp_port);
-		sockaddr.sa6.sin6_addr = in6addr_any;
-		socklen = sizeof(sockaddr.sa6);
-#endif
-	}
-	if (bind(g_udp_sockfd, (struct sockaddr *)&sockaddr, socklen) == -1) {
-		logit(LOG_ERR, errno, "could not bind UDP socket to port %d", g_udp_port);
-		exit(EXIT_SYSCALL);
-	}
-
-#ifndef __FreeBSD__
-	if (g_bind_to_device) {
-		snprintf(ifreq.ifr_ifrn.ifrn_name, sizeof(ifreq.ifr_ifrn.ifrn_name), "%s", g_bind_to_device);
-		if (setsockopt(g_udp_sockfd, SOL_SOCKET, SO_BINDTODEVICE, (char *)&ifreq, sizeof(ifreq)) == -1) {
-			logit(LOG_WARNING, errno, "could not bind UDP socket to device %s", g_bind_to_device);
-			exit(EXIT_SYSCALL);
-		}
-	}
 #endif
 
 	/* Open the server's TCP port and prepare it for listening */
@@ -683,97 +1053,119 @@ int main(int argc, char *argv[])
 		logit(LOG_INFO, 0, "Successfully dropped privileges to %s:%s", g_user, g_user);
 	}
 
+#ifdef CONFIG_ENABLE_THREADS
+	/* From now on the MIB is only updated in the background */
+	if (mib_collector_start() || udp_workers_start())
+		exit(EXIT_SYSCALL);
+#endif
+
 	/*
 	 * Tell system we're up and running by creating /run/mini-snmpd.pid
 	 */
 	if (pidfile(NULL))
 		logit(LOG_ERR, errno, "Failed creating PID file");
 
+	/*
+	 * Wait for requests, link changes and the MIB refresh timer, which is
+	 * identified by &g_timeout, all sockets by the address of their fd.
+	 */
+	if (event_init() ||
+	    event_nonblock(g_udp_sockfd) || event_add(g_udp_sockfd, &g_udp_sockfd) ||
+	    event_nonblock(g_tcp_sockfd) || event_add(g_tcp_sockfd, &g_tcp_sockfd))
+		exit(EXIT_SYSCALL);
+#ifndef CONFIG_ENABLE_THREADS
+	if (link_sockfd != -1 && event_add(link_sockfd, &link_sockfd))
+		exit(EXIT_SYSCALL);
+
+	/* Sleep until the first MIB group is due for a refresh */
+	if (!g_lazy && timer_rearm(1))
+		exit(EXIT_SYSCALL);
+#endif
+
 	/* Handle incoming connect requests and incoming data */
 	while (!g_quit) {
-		/* Sleep until we get a request or the timeout is over */
-		FD_ZERO(&rfds);
-		FD_ZERO(&wfds);
-		FD_SET(g_udp_sockfd, &rfds);
-		FD_SET(g_tcp_sockfd, &rfds);
-		nfds = (g_udp_sockfd > g_tcp_sockfd) ? g_udp_sockfd : g_tcp_sockfd;
-
-		for (i = 0; i < g_tcp_client_list_length; i++) {
-			if (g_tcp_client_list[i]->outgoing)
-				FD_SET(g_tcp_client_list[i]->sockfd, &wfds);
-			else
-				FD_SET(g_tcp_client_list[i]->sockfd, &rfds);
-
-			if (nfds < g_tcp_client_list[i]->sockfd)
-				nfds = g_tcp_client_list[i]->sockfd;
-		}
-
-		if (select(nfds + 1, &rfds, &wfds, NULL, &tv_sleep) == -1) {
+		num = event_wait(event, NELEMS(event));
+		if (num == -1) {
 			if (g_quit)
 				break;
 
-			logit(LOG_ERR, errno, "could not select from sockets");
-			exit(EXIT_SYSCALL);
+			if (errno != EINTR) {
+				logit(LOG_ERR, errno, "could not wait for events");
+				exit(EXIT_SYSCALL);
+			}
+			num = 0;
 		}
 
-		/* Determine whether to update the MIB and the next ticks to sleep */
-		ticks = ticks_since(&tv_last, &tv_now);
-		if (ticks < 0 || ticks >= g_timeout) {
-			logit(LOG_DEBUG, 0, "updating the MIB (full)");
-			if (mib_update(1) == -1)
+#ifndef CONFIG_ENABLE_THREADS
+		/* On SIGHUP, with threads the collector reloads instead */
+		reloaded = 0;
+		if (g_reload) {
+			g_reload = 0;
+			if (config_reload() == -1)
 				exit(EXIT_SYSCALL);
+			reloaded = 1;
+		}
+
+		expired = request = 0;
+		for (c = 0; c < num; c++) {
+			void *arg = event[c].arg;
+
+			if (arg == &g_timeout)
+				expired = 1;
+			else if (arg == &g_udp_sockfd || (arg != &g_tcp_sockfd && arg != &link_sockfd && !event[c].write))
+				request = 1;
+		}
 
-			memcpy(&tv_last, &tv_now, sizeof(tv_now));
-			tv_sleep.tv_sec = g_timeout / 100;
-			tv_sleep.tv_usec = (g_timeout % 100) * 10000;
-		} else {
-			logit(LOG_DEBUG, 0, "updating the MIB (partial)");
+		/*
+		 * Refresh the MIB groups that are due when the timer has expired
+		 * or after a reload, and before requests if a group is refreshed
+		 * on every request, by default the uptimes.  Link changes, TCP
+		 * connects and writes need no refresh.  In lazy mode groups are
+		 * instead refreshed on lookup.
+		 */
+		if (!g_lazy && (expired || reloaded || (request && mib_per_request()))) {
+			logit(LOG_DEBUG, 0, "updating the MIB");
 			if (mib_update(0) == -1)
 				exit(EXIT_SYSCALL);
-
-			tv_sleep.tv_sec = (g_timeout - ticks) / 100;
-			tv_sleep.tv_usec = ((g_timeout - ticks) % 100) * 10000;
 		}
 
 #ifdef DEBUG
 		dump_mib(g_mib, g_mib_length);
 #endif
+#endif /* CONFIG_ENABLE_THREADS */
 
 		/* Handle UDP packets, TCP packets and TCP connection connects */
-		if (FD_ISSET(g_udp_sockfd, &rfds))
-			handle_udp_client();
-
-		if (FD_ISSET(g_tcp_sockfd, &rfds))
-			handle_tcp_connect();
-
-		for (i = 0; i < g_tcp_client_list_length; i++) {
-			if (g_tcp_client_list[i]->outgoing) {
-				if (FD_ISSET(g_tcp_client_list[i]->sockfd, &wfds))
-					handle_tcp_client_write(g_tcp_client_list[i]);
+		for (c = 0; c < num; c++) {
+			void *arg = event[c].arg;
+
+			if (arg == &g_udp_sockfd) {
+				while (!handle_udp_client(g_udp_sockfd, g_udp_client))
+					;
+			} else if (arg == &g_tcp_sockfd) {
+				while (!handle_tcp_connect())
+					;
+#ifndef CONFIG_ENABLE_THREADS
+			} else if (arg == &link_sockfd) {
+				/* Link state and address changes are applied right away */
+				if (mib_link_event() == -1)
+					exit(EXIT_SYSCALL);
+			} else if (arg == &g_timeout) {
+				/* The MIB has already been refreshed above */
+#endif
+			} else if (event[c].write) {
+				handle_tcp_client_write(arg);
 			} else {
-				if (FD_ISSET(g_tcp_client_list[i]->sockfd, &rfds))
-					handle_tcp_client_read(g_tcp_client_list[i]);
+				handle_tcp_client_read(arg);
 			}
 		}
 
-		/* If there was a TCP disconnect, remove the client from the list */
-		for (i = 0; i < g_tcp_client_list_length; i++) {
-			if (g_tcp_client_list[i]->sockfd == -1) {
-				g_tcp_client_list_length--;
-				if (i < g_tcp_client_list_length) {
-					size_t len = (g_tcp_client_list_length - i) * sizeof(g_tcp_client_list[i]);
-
-					free(g_tcp_client_list[i]);
-					memmove(&g_tcp_client_list[i], &g_tcp_client_list[i + 1], len);
-
-					/*
-					 * list changed, there could be more than
-					 * one to remove, start from begining
-					 */
-					i = -1;
-				}
-			}
-		}
+#ifndef CONFIG_ENABLE_THREADS
+		if (!g_lazy && timer_rearm(expired))
+			exit(EXIT_SYSCALL);
+#endif
+
+		/* No event refers to the TCP clients closed meanwhile any more */
+		client_reap();
 	}
 
 	/* We were signaled, print a message and exit */
@@ -34,16 +34,19 @@
 #define EXIT_ARGS                                       1
 #define EXIT_SYSCALL                                    2
 
-#define MAX_NR_CLIENTS                                  16
+#define MAX_NR_CLIENTS                                  1024
 #define MAX_NR_OIDS                                     20
 #define MAX_NR_SUBIDS                                   20
-#define MAX_NR_DISKS                                    4
-#define MAX_NR_INTERFACES                               8
-#define MAX_NR_VALUES                                   2048
+#define MAX_NR_EVENTS                                   64
+#define MAX_NR_UDP_BATCH                                16
+#define MAX_NR_WORKERS                                  64
 
 #define MAX_PACKET_SIZE                                 2048
 #define MAX_STRING_SIZE                                 64
 
+/* Smallest varbind: 2 byte header, 3 byte OID (.1.3.x) and 2 byte NULL */
+#define MAX_NR_VARBINDS                                 (MAX_PACKET_SIZE / 7)
+
 /*
  * SNMP dependent defines
  */
@@ -137,8 +140,14 @@ typedef struct client_s {
 	unsigned char       packet[MAX_PACKET_SIZE];
 	size_t              size;
 	int                 outgoing;
+	struct client_s    *next;	/* TCP clients closed or free */
 } client_t;
 
+typedef struct event_s {
+	void               *arg;
+	int                 write;
+} event_t;
+
 typedef struct oid_s {
 	unsigned int subid_list[MAX_NR_SUBIDS];
 	size_t       subid_list_length;
@@ -151,16 +160,54 @@ typedef struct data_s {
 	short          encoded_length;
 } data_t;
 
+/*
+ * The OID of a MIB entry, its subids for comparisons and its encoding,
+ * BER type and length included.  Both are stored in the MIB arena, next
+ * to the value.
+ */
+typedef struct mib_oid_s {
+	const unsigned int  *subid_list;
+	const unsigned char *encoded;
+	unsigned short       subid_list_length;
+	unsigned short       encoded_length;
+} mib_oid_t;
+
+/*
+ * In the arena, the sequence header, the OID and the value of an entry
+ * are consecutive, a complete varbind that is copied as is to responses.
+ * The header is updated with the value, varbind is NULL if the value has
+ * outgrown its slot in the arena.
+ *
+ * Values are only re-encoded when they change, scalars are compared with
+ * their last raw value.  The generation is bumped on every change, zero
+ * means never set, so copies of the MIB can skip unchanged entries.
+ */
 typedef struct value_s {
-	oid_t  oid;
-	data_t data;
+	mib_oid_t            oid;
+	data_t               data;
+	const unsigned char *varbind;
+	size_t               varbind_length;
+	uint64_t             raw;
+	unsigned int         generation;
 } value_t;
 
+/*
+ * The interface and UDP counters, read as 64 bits wide, or extended to
+ * 64 bits across wraps when the system only has 32-bit counters, see
+ * netinfo_track().  Counter32 columns export the lower 32 bits.
+ */
+typedef uint64_t counter_t;
+
+/* The width of a counter as the system keeps it, 32 or 64 bits */
+#define COUNTER_BITS(x) (sizeof(x) * 8)
+
+/* The values of a line, parsed into value[] or, for counters, counter[] */
 typedef struct field_s {
 	char         *prefix;
 
 	size_t        len;
 	long long    *value[24];
+	counter_t    *counter[24];
 } field_t;
 
 typedef struct request_s {
@@ -174,11 +221,19 @@ typedef struct request_s {
 	size_t    oid_list_length;
 } request_t;
 
+/* A MIB value, or an OID from the request, e.g. for an exception */
+typedef struct varbind_s {
+	const value_t *value;
+	const oid_t   *oid;
+	const data_t  *data;
+} varbind_t;
+
 typedef struct response_s {
-	int     error_status;
-	int     error_index;
-	value_t value_list[MAX_NR_VALUES];
-	size_t  value_list_length;
+	int        error_status;
+	int        error_index;
+	varbind_t *value_list;
+	size_t     value_list_length;
+	size_t     value_list_size;
 } response_t;
 
 typedef struct loadinfo_s {
@@ -202,39 +257,51 @@ typedef struct cpuinfo_s {
 	long long cntxts;
 } cpuinfo_t;
 
+/*
+ * The disk and interface statistics are kept per column, each column an
+ * array with one element per monitored disk or interface, all of them in
+ * one block of memory allocated by diskinfo_alloc() and netinfo_alloc().
+ */
 typedef struct diskinfo_s {
-	unsigned int total[MAX_NR_DISKS];
-	unsigned int free[MAX_NR_DISKS];
-	unsigned int used[MAX_NR_DISKS];
-	unsigned int blocks_used_percent[MAX_NR_DISKS];
-	unsigned int inodes_used_percent[MAX_NR_DISKS];
+	size_t        num;
+	size_t        size;
+	void         *block;
+	unsigned int *total;
+	unsigned int *free;
+	unsigned int *used;
+	unsigned int *blocks_used_percent;
+	unsigned int *inodes_used_percent;
 } diskinfo_t;
 
 typedef struct netinfo_s {
-	unsigned int in_addr[MAX_NR_INTERFACES];
-	unsigned int in_mask[MAX_NR_INTERFACES];
-	unsigned int in_bcaddr[MAX_NR_INTERFACES];
-	unsigned int in_bcent[MAX_NR_INTERFACES];
-	unsigned int if_type[MAX_NR_INTERFACES];
-	unsigned int if_mtu[MAX_NR_INTERFACES];
-	unsigned int if_speed[MAX_NR_INTERFACES];
-	unsigned int ifindex[MAX_NR_INTERFACES];
-	unsigned int status[MAX_NR_INTERFACES];
-	unsigned int lastchange[MAX_NR_INTERFACES];
-	unsigned int stats[MAX_NR_INTERFACES];		/* Sentinel for backends */
-	long long rx_bytes[MAX_NR_INTERFACES];
-	long long rx_mc_packets[MAX_NR_INTERFACES];
-	long long rx_bc_packets[MAX_NR_INTERFACES];
-	long long rx_packets[MAX_NR_INTERFACES];
-	long long rx_errors[MAX_NR_INTERFACES];
-	long long rx_drops[MAX_NR_INTERFACES];
-	long long tx_bytes[MAX_NR_INTERFACES];
-	long long tx_mc_packets[MAX_NR_INTERFACES];
-	long long tx_bc_packets[MAX_NR_INTERFACES];
-	long long tx_packets[MAX_NR_INTERFACES];
-	long long tx_errors[MAX_NR_INTERFACES];
-	long long tx_drops[MAX_NR_INTERFACES];
-	char mac_addr[MAX_NR_INTERFACES][6];
+	size_t        num;
+	size_t        size;
+	void         *block;
+	unsigned int *in_addr;
+	unsigned int *in_mask;
+	unsigned int *in_bcaddr;
+	unsigned int *in_bcent;
+	unsigned int *if_type;
+	unsigned int *if_mtu;
+	unsigned int *if_speed;
+	unsigned int *ifindex;
+	unsigned int *status;
+	unsigned int *lastchange;
+	unsigned int *discontinuity;	/* Of the counters, see netinfo_track() */
+	unsigned int *stats;		/* Width of the counters read, 0 if none */
+	counter_t    *rx_bytes;
+	counter_t    *rx_mc_packets;
+	counter_t    *rx_bc_packets;
+	counter_t    *rx_packets;
+	counter_t    *rx_errors;
+	counter_t    *rx_drops;
+	counter_t    *tx_bytes;
+	counter_t    *tx_mc_packets;
+	counter_t    *tx_bc_packets;
+	counter_t    *tx_packets;
+	counter_t    *tx_errors;
+	counter_t    *tx_drops;
+	char        (*mac_addr)[6];
 } netinfo_t;
 
  
@@ -262,12 +329,36 @@ typedef struct tcpinfo_s {
 } tcpinfo_t;
 
 typedef struct udpinfo_s {
-	long long udpInDatagrams;
-	long long udpNoPorts;
-	long long udpInErrors;
-	long long udpOutDatagrams;
+	counter_t udpInDatagrams;
+	counter_t udpNoPorts;
+	counter_t udpInErrors;
+	counter_t udpOutDatagrams;
+	unsigned int bits;		/* Width of the counters read */
 } udpinfo_t;
 
+/* IP, TCP and UDP statistics, read in one go */
+typedef struct protoinfo_s {
+	ipinfo_t  ip;
+	tcpinfo_t tcp;
+	udpinfo_t udp;
+} protoinfo_t;
+
+#ifdef CONFIG_ENABLE_RATES
+/*
+ * The rates of the interface counters, moving averages over each of the
+ * windows, for each interface its received and sent bytes and packets
+ */
+#define RATE_WINDOWS  3
+#define RATE_COUNTERS 4
+#define RATE_COLUMNS  (RATE_WINDOWS * RATE_COUNTERS)
+
+typedef struct rateinfo_s {
+	unsigned int  window[RATE_WINDOWS];	/* In seconds */
+	size_t        num;
+	counter_t   (*rate)[RATE_COLUMNS];	/* Per second */
+} rateinfo_t;
+#endif
+
 #ifdef CONFIG_ENABLE_DEMO
 typedef struct demoinfo_s {
 	unsigned int random_value_1;
@@ -288,7 +379,11 @@ extern int       g_auth;
 extern int       g_daemon;
 extern int       g_syslog;
 extern int       g_level;
+extern int       g_lazy;
+extern int       g_workers;
+extern int       g_max_clients;
 extern volatile sig_atomic_t g_quit;
+extern volatile sig_atomic_t g_reload;
 
 extern char     *g_prognm;
 extern char     *g_community;
@@ -299,23 +394,33 @@ extern char     *g_contact;
 extern char     *g_bind_to_device;
 extern char     *g_user;
 
-extern char     *g_disk_list[MAX_NR_DISKS];
+extern char    **g_disk_glob;
+extern size_t    g_disk_glob_length;
+
+extern char    **g_disk_list;
+extern unsigned int *g_disk_index;
 extern size_t    g_disk_list_length;
 
-extern char     *g_interface_list[MAX_NR_INTERFACES];
+extern char    **g_interface_glob;
+extern size_t    g_interface_glob_length;
+
+extern char    **g_interface_list;
+extern unsigned int *g_interface_index;
 extern size_t    g_interface_list_length;
 
+#ifdef CONFIG_ENABLE_RATES
+extern unsigned int g_rate_window[RATE_WINDOWS];
+#endif
+
 extern in_port_t g_udp_port;
 extern in_port_t g_tcp_port;
 
-extern client_t  g_udp_client;
-extern client_t *g_tcp_client_list[MAX_NR_CLIENTS];
-extern size_t    g_tcp_client_list_length;
+extern client_t  g_udp_client[MAX_NR_UDP_BATCH];
 
 extern int       g_udp_sockfd;
 extern int       g_tcp_sockfd;
 
-extern value_t   g_mib[MAX_NR_VALUES];
+extern value_t  *g_mib;
 extern size_t    g_mib_length;
 
 /*
@@ -329,25 +434,43 @@ void         dump_response (const response_t *response);
 char        *oid_ntoa (const oid_t *oid);
 oid_t       *oid_aton (const char  *str);
 int          oid_cmp  (const oid_t *oid1, const oid_t *oid2);
+char        *mib_oid_ntoa(const mib_oid_t *oid);
+int          subid_cmp(const unsigned int *list1, size_t len1, const unsigned int *list2, size_t len2);
 
-int          split(const char *str, char *delim, char **list, int max_list_length);
+int          split(const char *str, char *delim, char ***list);
 
-client_t    *find_oldest_client(void);
 int          find_ifname(char *ifname);
+int          interface_match(const char *ifname);
+int          interface_discover(void);
+int          disk_discover(void);
 
 void        *allocate    (size_t len);
 
-int          read_config (char *file);
+int          diskinfo_alloc(diskinfo_t *diskinfo, size_t num);
+void         diskinfo_clear(diskinfo_t *diskinfo);
+int          netinfo_alloc (netinfo_t  *netinfo,  size_t num);
+void         netinfo_clear (netinfo_t  *netinfo);
+void         netinfo_track (netinfo_t  *netinfo);
+void         udpinfo_track (udpinfo_t  *udpinfo);
+#ifdef CONFIG_ENABLE_RATES
+int          rateinfo_alloc(rateinfo_t *rateinfo, size_t num);
+void         get_rateinfo  (rateinfo_t *rateinfo, const netinfo_t *netinfo, unsigned long long now);
+int          rate_window   (unsigned int *window, size_t i, long sec);
+#endif
+
+int          read_config (char *file, int reload);
+int          config_reload(void);
 
 int          parse_file  (char *file, field_t fields[], size_t limit, size_t skip_prefix);
+int          parse_text  (char *buf, field_t fields[], size_t limit);
 int          read_file   (const char *filename, char *buffer, size_t size);
+char        *read_file_cached(const char *filename);
 
 unsigned int read_value  (const char *buffer, const char *prefix);
 void         read_values (const char *buffer, const char *prefix, unsigned int *values, int count);
 
 int          read_file_value(unsigned int *val, const char *fmt, ...);
 
-int          ticks_since (const struct timeval *tv_last, struct timeval *tv_now);
 
 unsigned int get_process_uptime (void);
 unsigned int get_system_uptime  (void);
@@ -355,10 +478,9 @@ unsigned int get_system_uptime  (void);
 void         get_loadinfo       (loadinfo_t *loadinfo);
 void         get_meminfo        (meminfo_t *meminfo);
 void         get_cpuinfo        (cpuinfo_t *cpuinfo);
-void         get_ipinfo         (ipinfo_t *ipinfo);
-void         get_tcpinfo        (tcpinfo_t *tcpinfo);
-void         get_udpinfo        (udpinfo_t *udpinfo);
+void         get_protoinfo      (protoinfo_t *protoinfo);
 void         get_diskinfo       (diskinfo_t *diskinfo);
+int          get_mounts         (char ***list);
 void         get_netinfo        (netinfo_t *netinfo);
 #ifdef CONFIG_ENABLE_DEMO
 void         get_demoinfo       (demoinfo_t *demoinfo);
@@ -369,11 +491,32 @@ int snmp_packet_complete   (const client_t *client);
 int snmp                   (      client_t *client);
 int snmp_element_as_string (const data_t *data, char *buffer, size_t size);
 
-int mib_build    (void);
-int mib_update   (int full);
+int mib_build       (void);
+int mib_update      (int full);
+int mib_reload      (void);
+int mib_timeout     (void);
+int mib_per_request (void);
+int mib_set_refresh (const char *group, int interval);
+unsigned long long mib_ticks(void);
 
 value_t *mib_find     (const oid_t *oid, size_t *pos);
-value_t *mib_findnext (const oid_t *oid);
+value_t *mib_findnext (const oid_t *oid, size_t *pos);
+value_t *mib_next     (size_t *pos);
+void     mib_acquire  (void);
+void     mib_release  (void);
+const char *mib_community(void);
+int      mib_auth     (void);
+int      mib_link_event(void);
+#ifdef CONFIG_ENABLE_THREADS
+int      mib_collector_start(void);
+#endif
+
+int      event_init    (void);
+int      event_nonblock(int fd);
+int      event_add     (int fd, void *arg);
+int      event_mod     (int fd, void *arg, int write);
+int      event_timer   (int ticks, void *arg);
+int      event_wait    (event_t *event, int num);
 
 #ifdef CONFIG_ENABLE_ETHTOOL
 int ethtool_gstats(int intf, netinfo_t *netinfo, field_t *field);
@@ -381,6 +524,16 @@ int ethtool_gstats(int intf, netinfo_t *netinfo, field_t *field);
 #define ethtool_gstats(intf, netinfo, field) (-1)
 #endif
 
+#if defined(__linux__) && defined(CONFIG_ENABLE_NETLINK)
+int netlink_netinfo(netinfo_t *netinfo);
+int netlink_event_open(void);
+int netlink_event(netinfo_t *netinfo);
+#else
+#define netlink_netinfo(netinfo) (-1)
+#define netlink_event_open()     (-1)
+#define netlink_event(netinfo)   ((void)(netinfo), -1)
+#endif
+
 #endif /* MINI_SNMPD_H_ */
 
 /* vim: ts=4 sts=4 sw=4 nowrap
@@ -15,6 +15,10 @@
  * See COPYING for GPL licensing information.
  */
 
+#ifdef HAVE_ALLOCA_H
+#include <alloca.h>
+#endif
+#include <stddef.h>		/* offsetof() */
 #include <syslog.h>
 #include <string.h>
 #include <stdlib.h>
@@ -31,9 +35,9 @@
 
 #define SNMP_VERSION_2_ERROR(resp, req, index, err) {			\
 	size_t len = (resp)->value_list_length;				\
-	memcpy(&(resp)->value_list[len].oid, &(req)->oid_list[index],	\
-	       sizeof((req)->oid_list[index]));				\
-	memcpy(&(resp)->value_list[len].data, &err, sizeof(err));	\
+	(resp)->value_list[len].value = NULL;				\
+	(resp)->value_list[len].oid   = &(req)->oid_list[index];	\
+	(resp)->value_list[len].data  = &err;				\
 	(resp)->value_list_length++;					\
 	continue;							\
 }
@@ -42,7 +46,7 @@
 	if ((req)->version == SNMP_VERSION_1)				\
 		SNMP_VERSION_1_ERROR((resp), (code), (index));		\
 									\
-	if ((resp)->value_list_length < MAX_NR_VALUES)			\
+	if ((resp)->value_list_length < (resp)->value_list_size)	\
 		SNMP_VERSION_2_ERROR((resp), (req), (index), err); 	\
 									\
 	logit(LOG_ERR, 0, "%s", msg);					\
@@ -610,32 +614,55 @@ static int log_encoding_error(const char *what, const char *why)
 	return -1;
 }
 
-static int encode_snmp_varbind(unsigned char *buf, size_t *pos, const value_t *value)
+static char *varbind_ntoa(const varbind_t *vb)
 {
-	size_t len;
+	if (vb->value)
+		return mib_oid_ntoa(&vb->value->oid);
+
+	return oid_ntoa(vb->oid);
+}
+
+static int encode_snmp_varbind(unsigned char *buf, size_t *pos, const varbind_t *vb)
+{
+	size_t len, oid_len;
+
+	/* MIB values kept as complete varbinds in the arena are copied as is */
+	if (vb->value && vb->value->varbind) {
+		len = vb->value->varbind_length;
+		if (*pos < len)
+			return log_encoding_error(varbind_ntoa(vb), "VARBIND overflow");
+
+		memcpy(&buf[*pos - len], vb->value->varbind, len);
+		*pos = *pos - len;
+
+		return 0;
+	}
 
 	/* The value of the variable binding (NULL for error responses) */
-	len = value->data.encoded_length;
+	len = vb->data->encoded_length;
 	if (*pos < len)
-		return log_encoding_error(oid_ntoa(&value->oid), "DATA overflow");
+		return log_encoding_error(varbind_ntoa(vb), "DATA overflow");
 
-	memcpy(&buf[*pos - len], value->data.buffer, len);
+	memcpy(&buf[*pos - len], vb->data->buffer, len);
 	*pos = *pos - len;
 
-	/* The OID of the variable binding */
-	len = value->oid.encoded_length;
-	if (*pos < len)
-		return log_encoding_error(oid_ntoa(&value->oid), "OID overflow");
+	/* The OID of the variable binding, already encoded for MIB values */
+	oid_len = vb->value ? vb->value->oid.encoded_length : (size_t)vb->oid->encoded_length;
+	if (*pos < oid_len)
+		return log_encoding_error(varbind_ntoa(vb), "OID overflow");
 
-	encode_snmp_oid(&buf[*pos - len], &value->oid);
-	*pos = *pos - len;
+	if (vb->value)
+		memcpy(&buf[*pos - oid_len], vb->value->oid.encoded, oid_len);
+	else
+		encode_snmp_oid(&buf[*pos - oid_len], vb->oid);
+	*pos = *pos - oid_len;
 
 	/* The sequence header (type and length) of the variable binding */
-	len = get_hdrlen(value->oid.encoded_length + value->data.encoded_length);
+	len = get_hdrlen(oid_len + vb->data->encoded_length);
 	if (*pos < len)
-		return log_encoding_error(oid_ntoa(&value->oid), "VARBIND overflow");
+		return log_encoding_error(varbind_ntoa(vb), "VARBIND overflow");
 
-	encode_snmp_sequence_header(&buf[*pos - len], value->oid.encoded_length + value->data.encoded_length, BER_TYPE_SEQUENCE);
+	encode_snmp_sequence_header(&buf[*pos - len], oid_len + vb->data->encoded_length, BER_TYPE_SEQUENCE);
 	*pos = *pos - len;
 
 	return 0;
@@ -649,12 +676,13 @@ static int encode_snmp_response(request_t *request, response_t *response, client
 	 * omit any varbind values (replace them with NULL values)
 	 */
 	if (response->error_status != SNMP_STATUS_OK) {
-		if (request->oid_list_length > MAX_NR_VALUES)
+		if (request->oid_list_length > response->value_list_size)
 			return log_encoding_error("SNMP response", "value list overflow");
 
 		for (i = 0; i < request->oid_list_length && i < NELEMS(request->oid_list); i++) {
-			memcpy(&response->value_list[i].oid, &request->oid_list[i], sizeof(request->oid_list[i]));
-			memcpy(&response->value_list[i].data, &m_null, sizeof(m_null));
+			response->value_list[i].value = NULL;
+			response->value_list[i].oid   = &request->oid_list[i];
+			response->value_list[i].data  = &m_null;
 		}
 		response->value_list_length = request->oid_list_length;
 	}
@@ -743,6 +771,16 @@ static int encode_snmp_response(request_t *request, response_t *response, client
 	return 0;
 }
 
+/* Append a reference to a MIB value, the caller checks for space */
+static void append_value(response_t *response, const value_t *value)
+{
+	varbind_t *vb = &response->value_list[response->value_list_length++];
+
+	vb->value = value;
+	vb->oid   = NULL;
+	vb->data  = &value->data;
+}
+
 static int handle_snmp_get(request_t *request, response_t *response, client_t *UNUSED(client))
 {
 	size_t i, pos;
@@ -760,18 +798,14 @@ static int handle_snmp_get(request_t *request, response_t *response, client_t *U
 		if (!value)
 			SNMP_GET_ERROR(response, request, i, SNMP_STATUS_NO_SUCH_NAME, m_no_such_object, msg);
 
-		if (pos >= g_mib_length)
-			SNMP_GET_ERROR(response, request, i, SNMP_STATUS_NO_SUCH_NAME, m_no_such_object, msg);
-
 		if (value->oid.subid_list_length == (request->oid_list[i].subid_list_length + 1))
 			SNMP_GET_ERROR(response, request, i, SNMP_STATUS_NO_SUCH_NAME, m_no_such_instance, msg);
 
 		if (value->oid.subid_list_length != request->oid_list[i].subid_list_length)
 			SNMP_GET_ERROR(response, request, i, SNMP_STATUS_NO_SUCH_NAME, m_no_such_object, msg);
 
-		if (response->value_list_length < MAX_NR_VALUES) {
-			memcpy(&response->value_list[response->value_list_length], value, sizeof(*value));
-			response->value_list_length++;
+		if (response->value_list_length < response->value_list_size) {
+			append_value(response, value);
 			continue;
 		}
 
@@ -784,7 +818,7 @@ static int handle_snmp_get(request_t *request, response_t *response, client_t *U
 
 static int handle_snmp_getnext(request_t *request, response_t *response, client_t *UNUSED(client))
 {
-	size_t i;
+	size_t i, pos;
 	value_t *value;
 	const char *msg = "Failed handling SNMP GETNEXT: value list overflow\n";
 
@@ -794,13 +828,13 @@ static int handle_snmp_getnext(request_t *request, response_t *response, client_
 	 * subid of the requested one (table cell of table column)!
 	 */
 	for (i = 0; i < request->oid_list_length; i++) {
-		value = mib_findnext(&request->oid_list[i]);
+		pos = 0;
+		value = mib_findnext(&request->oid_list[i], &pos);
 		if (!value)
 			SNMP_GET_ERROR(response, request, i, SNMP_STATUS_NO_SUCH_NAME, m_end_of_mib_view, msg);
 
-		if (response->value_list_length < MAX_NR_VALUES) {
-			memcpy(&response->value_list[response->value_list_length], value, sizeof(*value));
-			response->value_list_length++;
+		if (response->value_list_length < response->value_list_size) {
+			append_value(response, value);
 			continue;
 		}
 
@@ -819,26 +853,23 @@ static int handle_snmp_set(request_t *request, response_t *response, client_t *U
 
 static int handle_snmp_getbulk(request_t *request, response_t *response, client_t *UNUSED(client))
 {
-	size_t i, j;
-	oid_t oid_list[MAX_NR_OIDS];
+	size_t i, j, repeaters = 0;
+	size_t pos[MAX_NR_OIDS];
 	value_t *value;
 	const char *msg = "Failed handling SNMP GETBULK: value list overflow\n";
 
-	/* Make a local copy of the OID list since we are going to modify it */
-	memcpy(oid_list, request->oid_list, sizeof(request->oid_list));
-
 	/* The non-repeaters are handled like with the GETNEXT request */
 	for (i = 0; i < request->oid_list_length; i++) {
 		if (i >= request->non_repeaters)
 			break;
 
-		value = mib_findnext(&oid_list[i]);
+		pos[i] = 0;
+		value = mib_findnext(&request->oid_list[i], &pos[i]);
 		if (!value)
 			SNMP_GET_ERROR(response, request, i, SNMP_STATUS_NO_SUCH_NAME, m_end_of_mib_view, msg);
 
-		if (response->value_list_length < MAX_NR_VALUES) {
-			memcpy(&response->value_list[response->value_list_length], value, sizeof(*value));
-			response->value_list_length++;
+		if (response->value_list_length < response->value_list_size) {
+			append_value(response, value);
 			continue;
 		}
 
@@ -855,19 +886,32 @@ static int handle_snmp_getbulk(request_t *request, response_t *response, client_
 	 *   for all of the varbinds
 	 * - other than with getnext, the last variable in the MIB is named if
 	 *   the variable queried is not after the end of the MIB
+	 *
+	 * Only the first repetition needs a lookup, the MIB is sorted so each
+	 * following repetition is simply the next entry after the cursor.
 	 */
+	if (request->oid_list_length > request->non_repeaters)
+		repeaters = request->oid_list_length - request->non_repeaters;
+
 	for (j = 0; j < request->max_repetitions; j++) {
 		int found_repeater = 0;
 
+		/* Truncate rather than fail, more would not fit in the packet */
+		if (response->value_list_size - response->value_list_length < repeaters)
+			break;
+
 		for (i = request->non_repeaters; i < request->oid_list_length; i++) {
-			value = mib_findnext(&oid_list[i]);
+			if (j == 0) {
+				pos[i] = 0;
+				value = mib_findnext(&request->oid_list[i], &pos[i]);
+			} else {
+				value = mib_next(&pos[i]);
+			}
 			if (!value)
 				SNMP_GET_ERROR(response, request, i, SNMP_STATUS_NO_SUCH_NAME, m_end_of_mib_view, msg);
 
-			if (response->value_list_length < MAX_NR_VALUES) {
-				memcpy(&response->value_list[response->value_list_length], value, sizeof(*value));
-				response->value_list_length++;
-				memcpy(&oid_list[i], &value->oid, sizeof(value->oid));
+			if (response->value_list_length < response->value_list_size) {
+				append_value(response, value);
 				found_repeater++;
 				continue;
 			}
@@ -884,6 +928,31 @@ static int handle_snmp_getbulk(request_t *request, response_t *response, client_
 }
 
 
+/* The number of varbinds a request can result in, bounded by packet size */
+static size_t response_size(const request_t *request)
+{
+	size_t len = request->oid_list_length;
+	size_t non_repeaters, repeaters;
+
+	if (request->type == BER_TYPE_SNMP_GETBULK) {
+		non_repeaters = request->non_repeaters;
+		if (non_repeaters > len)
+			non_repeaters = len;
+
+		repeaters = len - non_repeaters;
+		if (repeaters && request->max_repetitions > (MAX_NR_VARBINDS - non_repeaters) / repeaters)
+			return MAX_NR_VARBINDS;
+
+		len = non_repeaters + repeaters * request->max_repetitions;
+	}
+
+	/* Error responses echo all varbinds of the request */
+	if (len < request->oid_list_length)
+		len = request->oid_list_length;
+
+	return len;
+}
+
 int snmp_packet_complete(const client_t *client)
 {
 	int type;
@@ -915,61 +984,79 @@ int snmp(client_t *client)
 {
 	response_t response;
 	request_t request;
+	int rc = 0;
 
-	/* Setup request and response (other code only changes non-defaults) */
-	memset(&request, 0, sizeof(request));
+	/*
+	 * Setup request and response (other code only changes non-defaults),
+	 * the OID list is filled in by the decoder and needs no clearing.
+	 */
+	memset(&request, 0, offsetof(request_t, oid_list));
 	memset(&response, 0, sizeof(response));
 
 	/* Decode the request (only checks for syntax of the packet) */
 	if (decode_snmp_request(&request, client) == -1)
 		return -1;
 
+	/* The response only references MIB values, reserve what can be used */
+	response.value_list_size = response_size(&request);
+	response.value_list = alloca(response.value_list_size * sizeof(varbind_t));
+
 	/*
 	 * If we are using SNMP v2c or require authentication, check the community
-	 * string for length and validity.
+	 * string for length and validity.  The settings are those of the MIB
+	 * pinned, which with threads may be reloaded meanwhile.
 	 */
+	mib_acquire();
 	if (request.version == SNMP_VERSION_2C) {
-		if (strcmp(g_community, request.community)) {
+		if (strcmp(mib_community(), request.community)) {
 			response.error_status = (request.version == SNMP_VERSION_2C) ? SNMP_STATUS_NO_ACCESS : SNMP_STATUS_GEN_ERR;
 			response.error_index = 0;
 			goto done;
 		}
-	} else if (g_auth) {
+	} else if (mib_auth()) {
 		response.error_status = SNMP_STATUS_GEN_ERR;
 		response.error_index = 0;
 		goto done;
 	}
 
-	/* Now handle the SNMP requests depending on their type */
+	/*
+	 * Now handle the SNMP requests depending on their type, the response
+	 * references values in the MIB so keep it pinned until encoded.
+	 */
 	switch (request.type) {
 	case BER_TYPE_SNMP_GET:
-		if (handle_snmp_get(&request, &response, client) == -1)
-			return -1;
+		rc = handle_snmp_get(&request, &response, client);
 		break;
 
 	case BER_TYPE_SNMP_GETNEXT:
-		if (handle_snmp_getnext(&request, &response, client) == -1)
-			return -1;
+		rc = handle_snmp_getnext(&request, &response, client);
 		break;
 
 	case BER_TYPE_SNMP_SET:
-		if (handle_snmp_set(&request, &response, client) == -1)
-			return -1;
+		rc = handle_snmp_set(&request, &response, client);
 		break;
 
 	case BER_TYPE_SNMP_GETBULK:
-		if (handle_snmp_getbulk(&request, &response, client) == -1)
-			return -1;
+		rc = handle_snmp_getbulk(&request, &response, client);
 		break;
 
 	default:
 		logit(LOG_ERR, 0, "UNHANDLED REQUEST TYPE %d", request.type);
 		client->size = 0;
-		return 0;
+		goto out;
 	}
 
-done:
 	/* Encode the request (depending on error status and encode flags) */
+	if (rc != -1)
+		rc = encode_snmp_response(&request, &response, client);
+out:
+	mib_release();
+
+	return rc;
+
+done:
+	/* Encode an error response, no MIB values are referenced */
+	mib_release();
 	if (encode_snmp_response(&request, &response, client) == -1)
 		return -1;
 
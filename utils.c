@@ -16,6 +16,7 @@
 
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <net/if.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #ifdef HAVE_ALLOCA_H
@@ -28,7 +29,10 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <fnmatch.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "mini-snmpd.h"
 
@@ -44,6 +48,426 @@ void *allocate(size_t len)
 	return buf;
 }
 
+/* Columns start on a counter_t boundary, the widest element type */
+#define COLUMN_SIZE(num, type) \
+	(((num) * sizeof(type) + sizeof(counter_t) - 1) & ~(sizeof(counter_t) - 1))
+
+/* Return the next column of the block, or NULL when only sizing the block */
+static void *column(char *block, size_t *offset, size_t len)
+{
+	void *ptr = block ? block + *offset : NULL;
+
+	*offset += len;
+
+	return ptr;
+}
+
+static size_t diskinfo_layout(diskinfo_t *diskinfo, char *block, size_t num)
+{
+	size_t len = COLUMN_SIZE(num, unsigned int);
+	size_t offset = 0;
+
+	diskinfo->total               = column(block, &offset, len);
+	diskinfo->free                = column(block, &offset, len);
+	diskinfo->used                = column(block, &offset, len);
+	diskinfo->blocks_used_percent = column(block, &offset, len);
+	diskinfo->inodes_used_percent = column(block, &offset, len);
+
+	return offset;
+}
+
+static size_t netinfo_layout(netinfo_t *netinfo, char *block, size_t num)
+{
+	size_t len = COLUMN_SIZE(num, counter_t);
+	size_t offset = 0;
+
+	netinfo->rx_bytes      = column(block, &offset, len);
+	netinfo->rx_mc_packets = column(block, &offset, len);
+	netinfo->rx_bc_packets = column(block, &offset, len);
+	netinfo->rx_packets    = column(block, &offset, len);
+	netinfo->rx_errors     = column(block, &offset, len);
+	netinfo->rx_drops      = column(block, &offset, len);
+	netinfo->tx_bytes      = column(block, &offset, len);
+	netinfo->tx_mc_packets = column(block, &offset, len);
+	netinfo->tx_bc_packets = column(block, &offset, len);
+	netinfo->tx_packets    = column(block, &offset, len);
+	netinfo->tx_errors     = column(block, &offset, len);
+	netinfo->tx_drops      = column(block, &offset, len);
+
+	len = COLUMN_SIZE(num, unsigned int);
+	netinfo->in_addr       = column(block, &offset, len);
+	netinfo->in_mask       = column(block, &offset, len);
+	netinfo->in_bcaddr     = column(block, &offset, len);
+	netinfo->in_bcent      = column(block, &offset, len);
+	netinfo->if_type       = column(block, &offset, len);
+	netinfo->if_mtu        = column(block, &offset, len);
+	netinfo->if_speed      = column(block, &offset, len);
+	netinfo->ifindex       = column(block, &offset, len);
+	netinfo->status        = column(block, &offset, len);
+	netinfo->lastchange    = column(block, &offset, len);
+	netinfo->discontinuity = column(block, &offset, len);
+	netinfo->stats         = column(block, &offset, len);
+
+	netinfo->mac_addr      = column(block, &offset, COLUMN_SIZE(num, char[6]));
+
+	return offset;
+}
+
+/* (Re)size the statistics for num disks, all values are zeroed */
+int diskinfo_alloc(diskinfo_t *diskinfo, size_t num)
+{
+	diskinfo_t tmp;
+	char *block;
+	size_t size;
+
+	size = diskinfo_layout(&tmp, NULL, num);
+	block = calloc(1, size + 1);
+	if (!block) {
+		logit(LOG_ERR, errno, "Failed allocating disk statistics");
+		return -1;
+	}
+
+	free(diskinfo->block);
+	diskinfo->num   = num;
+	diskinfo->size  = size;
+	diskinfo->block = block;
+	diskinfo_layout(diskinfo, block, num);
+
+	return 0;
+}
+
+void diskinfo_clear(diskinfo_t *diskinfo)
+{
+	memset(diskinfo->block, 0, diskinfo->size);
+}
+
+/* (Re)size the statistics for num interfaces, all values are zeroed */
+int netinfo_alloc(netinfo_t *netinfo, size_t num)
+{
+	netinfo_t tmp;
+	char *block;
+	size_t size;
+
+	size = netinfo_layout(&tmp, NULL, num);
+	block = calloc(1, size + 1);
+	if (!block) {
+		logit(LOG_ERR, errno, "Failed allocating interface statistics");
+		return -1;
+	}
+
+	free(netinfo->block);
+	netinfo->num   = num;
+	netinfo->size  = size;
+	netinfo->block = block;
+	netinfo_layout(netinfo, block, num);
+
+	return 0;
+}
+
+void netinfo_clear(netinfo_t *netinfo)
+{
+	memset(netinfo->block, 0, netinfo->size);
+}
+
+/*
+ * A counter as last read, and as exported, extended to 64 bits.  A counter
+ * read lower than before has either wrapped, when the system only keeps 32
+ * bits of it, or has been reset, e.g. by a driver reload, which is then a
+ * discontinuity of the counter, see RFC 2863.
+ */
+struct counter {
+	counter_t last;
+	counter_t value;
+	int       valid;
+};
+
+#define NETINFO_COUNTERS 12
+
+/* The counters of each interface, by ifIndex as in g_interface_index */
+struct counters {
+	unsigned int   ifindex;
+	unsigned int   discontinuity;
+	struct counter counter[NETINFO_COUNTERS];
+};
+
+static struct counters *m_counters;
+static size_t           m_counters_length;
+static struct counter   m_udp_in;
+static struct counter   m_udp_out;
+
+/*
+ * Account for a new reading of a counter, of the given width in bits,
+ * returns its 64-bit value.  A 32-bit counter below its last value is
+ * taken to have wrapped if that was by less than half its range, any
+ * other drop, and every drop of a 64-bit counter, is a reset.
+ */
+static counter_t counter_track(struct counter *c, counter_t now, unsigned int bits, int *reset)
+{
+	counter_t delta = now - c->last;
+
+	if (!c->valid) {
+		c->value = now;
+		c->valid = 1;
+	} else if (now >= c->last) {
+		c->value += delta;
+	} else if (bits < 64 && c->last <= UINT32_MAX && (uint32_t)delta < 0x80000000U) {
+		c->value += (uint32_t)delta;
+	} else {
+		c->value = now;
+		*reset = 1;
+	}
+	c->last = now;
+
+	return c->value;
+}
+
+/* Follow the interfaces as they come and go, like the rows of the MIB */
+static int counters_sync(void)
+{
+	struct counters *counters;
+	size_t i, j, len = g_interface_list_length;
+
+	for (i = 0; i < len && len == m_counters_length; i++) {
+		if (m_counters[i].ifindex != g_interface_index[i])
+			break;
+	}
+	if (len == m_counters_length && i == len && m_counters)
+		return 0;
+
+	counters = calloc(len + 1, sizeof(*counters));
+	if (!counters) {
+		logit(LOG_ERR, errno, "Failed allocating interface counters");
+		return -1;
+	}
+
+	for (i = 0; i < len; i++) {
+		for (j = 0; j < m_counters_length; j++) {
+			if (m_counters[j].ifindex == g_interface_index[i])
+				break;
+		}
+
+		/* Counters of an interface created later start then */
+		if (j < m_counters_length)
+			counters[i] = m_counters[j];
+		else if (m_counters)
+			counters[i].discontinuity = get_process_uptime();
+		counters[i].ifindex = g_interface_index[i];
+	}
+
+	free(m_counters);
+	m_counters        = counters;
+	m_counters_length = len;
+
+	return 0;
+}
+
+/*
+ * Called with the counters just read by get_netinfo(), extends them to 64
+ * bits and sets the discontinuity time of each interface, in ticks since
+ * start, or zero if its counters never had one.
+ */
+void netinfo_track(netinfo_t *netinfo)
+{
+	counter_t *column[NETINFO_COUNTERS] = {
+		netinfo->rx_bytes,
+		netinfo->rx_mc_packets,
+		netinfo->rx_bc_packets,
+		netinfo->rx_packets,
+		netinfo->rx_errors,
+		netinfo->rx_drops,
+		netinfo->tx_bytes,
+		netinfo->tx_mc_packets,
+		netinfo->tx_bc_packets,
+		netinfo->tx_packets,
+		netinfo->tx_errors,
+		netinfo->tx_drops,
+	};
+	size_t i, k;
+
+	if (counters_sync())
+		return;
+
+	for (i = 0; i < netinfo->num && i < m_counters_length; i++) {
+		struct counters *counters = &m_counters[i];
+		int reset = 0;
+
+		if (netinfo->stats[i]) {
+			for (k = 0; k < NETINFO_COUNTERS; k++)
+				column[k][i] = counter_track(&counters->counter[k], column[k][i], netinfo->stats[i], &reset);
+		}
+
+		if (reset)
+			counters->discontinuity = get_process_uptime();
+		netinfo->discontinuity[i] = counters->discontinuity;
+	}
+}
+
+/* The same for the UDP datagram counters of the udpHC columns */
+void udpinfo_track(udpinfo_t *udpinfo)
+{
+	int reset = 0;
+
+	if (!udpinfo->bits)
+		return;
+
+	udpinfo->udpInDatagrams  = counter_track(&m_udp_in,  udpinfo->udpInDatagrams,  udpinfo->bits, &reset);
+	udpinfo->udpOutDatagrams = counter_track(&m_udp_out, udpinfo->udpOutDatagrams, udpinfo->bits, &reset);
+}
+
+#ifdef CONFIG_ENABLE_RATES
+/*
+ * The moving averages of the rates of each interface, by ifIndex as in
+ * g_interface_index, with the counters and the time of the last sample
+ */
+struct rate {
+	unsigned int       ifindex;
+	int                valid;	/* Averages seeded */
+	unsigned long long last;	/* Ticks, 0 until the first sample */
+	counter_t          count[RATE_COUNTERS];
+	double             avg[RATE_WINDOWS][RATE_COUNTERS];
+};
+
+static struct rate *m_rate;
+static size_t       m_rate_length;
+
+/* Set the length of window i of the interface rates, in seconds, in window[] */
+int rate_window(unsigned int *window, size_t i, long sec)
+{
+	if (i >= RATE_WINDOWS) {
+		logit(LOG_ERR, 0, "Too many rate windows, max %d", RATE_WINDOWS);
+		return -1;
+	}
+
+	if (sec < 1 || sec > 86400) {
+		logit(LOG_ERR, 0, "Invalid rate window %ld sec, valid range 1-86400", sec);
+		return -1;
+	}
+
+	window[i] = sec;
+
+	return 0;
+}
+
+/* (Re)size the rates for num interfaces, all values are zeroed */
+int rateinfo_alloc(rateinfo_t *rateinfo, size_t num)
+{
+	counter_t (*rate)[RATE_COLUMNS];
+
+	rate = calloc(num + 1, sizeof(*rate));
+	if (!rate) {
+		logit(LOG_ERR, errno, "Failed allocating interface rates");
+		return -1;
+	}
+
+	free(rateinfo->rate);
+	rateinfo->num  = num;
+	rateinfo->rate = rate;
+
+	return 0;
+}
+
+/* Follow the interfaces as they come and go, like the rows of the MIB */
+static int rates_sync(void)
+{
+	struct rate *rate;
+	size_t i, j, len = g_interface_list_length;
+
+	for (i = 0; i < len && len == m_rate_length; i++) {
+		if (m_rate[i].ifindex != g_interface_index[i])
+			break;
+	}
+	if (len == m_rate_length && i == len && m_rate)
+		return 0;
+
+	rate = calloc(len + 1, sizeof(*rate));
+	if (!rate) {
+		logit(LOG_ERR, errno, "Failed allocating interface rates");
+		return -1;
+	}
+
+	for (i = 0; i < len; i++) {
+		for (j = 0; j < m_rate_length; j++) {
+			if (m_rate[j].ifindex == g_interface_index[i])
+				break;
+		}
+
+		if (j < m_rate_length)
+			rate[i] = m_rate[j];
+		rate[i].ifindex = g_interface_index[i];
+	}
+
+	free(m_rate);
+	m_rate        = rate;
+	m_rate_length = len;
+
+	return 0;
+}
+
+/*
+ * Called with the counters read at now, in ticks, feeds the rate of each
+ * counter since the last sample into its moving averages.  The weight of
+ * a sample grows with the time it covers, dt / (window + dt), so samples
+ * taken at irregular intervals, e.g. in lazy mode, average out right.  The
+ * first rate seeds the averages, a counter that was reset is skipped.
+ */
+void get_rateinfo(rateinfo_t *rateinfo, const netinfo_t *netinfo, unsigned long long now)
+{
+	size_t i, k, w;
+
+	memcpy(rateinfo->window, g_rate_window, sizeof(rateinfo->window));
+	if (rates_sync())
+		return;
+
+	for (i = 0; i < rateinfo->num && i < netinfo->num && i < m_rate_length; i++) {
+		const counter_t count[RATE_COUNTERS] = {
+			netinfo->rx_bytes[i],
+			netinfo->tx_bytes[i],
+			netinfo->rx_packets[i],
+			netinfo->tx_packets[i],
+		};
+		struct rate *rate = &m_rate[i];
+		double dt;
+
+		if (!netinfo->stats[i]) {
+			rate->last = 0;
+			continue;
+		}
+
+		if (rate->last && now > rate->last) {
+			dt = (now - rate->last) / 100.0;
+
+			for (k = 0; k < RATE_COUNTERS; k++) {
+				double val;
+
+				if (count[k] < rate->count[k])
+					continue;
+
+				val = (count[k] - rate->count[k]) / dt;
+				for (w = 0; w < RATE_WINDOWS; w++) {
+					double *avg = &rate->avg[w][k];
+
+					if (rate->valid)
+						*avg += (val - *avg) * dt / (rateinfo->window[w] + dt);
+					else
+						*avg = val;
+				}
+			}
+			rate->valid = 1;
+		}
+
+		if (now != rate->last) {
+			memcpy(rate->count, count, sizeof(rate->count));
+			rate->last = now;
+		}
+
+		for (w = 0; w < RATE_WINDOWS; w++) {
+			for (k = 0; k < RATE_COUNTERS; k++)
+				rateinfo->rate[i][w * RATE_COUNTERS + k] = rate->avg[w][k] + 0.5;
+		}
+	}
+}
+#endif /* CONFIG_ENABLE_RATES */
+
 
 static inline int parse_lineint(char *buf, field_t *f, size_t *skip_prefix)
 {
@@ -80,30 +504,207 @@ static inline int parse_lineint(char *buf, field_t *f, size_t *skip_prefix)
 
 		if (f->value[i]) {
 			*(f->value[i]) = strtoll(ptr, NULL, 0);
+		} else if (f->counter[i]) {
+			*(f->counter[i]) = strtoull(ptr, NULL, 0);
 		}
 
-		while (!isspace(*ptr))
+		while (*ptr && !isspace(*ptr))
 			ptr++;
 	}
 
 	return 1;
 }
 
+/*
+ * Cache of open /proc and /sys files.  Each file is opened on the first
+ * read and then kept open, every read is a pread() from the start, so a
+ * refresh costs one syscall per file instead of three.  When the file
+ * goes stale, e.g. the interface of a /sys/class/net file is removed or
+ * recreated, the read fails with ENODEV and the file is reopened.
+ *
+ * The number of files kept open is fixed, well below the limit of open
+ * files, however many interfaces are monitored.  Files are found by a
+ * hash of their path, and when all are taken a file not read since the
+ * last round of replacements is closed to make room.
+ */
+#define MAX_NR_FILES    64
+#define FILE_HASH_SIZE  64
+
+static struct file_cache {
+	char              *path;
+	int                fd;
+	int                used;	/* Read since the last round */
+	char              *buf;
+	size_t             size;
+	struct file_cache *next;	/* In the same hash bucket */
+} m_file[MAX_NR_FILES];
+static struct file_cache *m_file_hash[FILE_HASH_SIZE];
+static size_t m_file_next;
+
+static unsigned int file_hash(const char *path)
+{
+	unsigned int hash = 5381;
+
+	while (*path)
+		hash = hash * 33 + (unsigned char)*path++;
+
+	return hash % FILE_HASH_SIZE;
+}
+
+/* Close the file and remove it from the cache, its buffer is reused */
+static void file_close(struct file_cache *file)
+{
+	struct file_cache **pp;
+
+	if (!file->path)
+		return;
+
+	for (pp = &m_file_hash[file_hash(file->path)]; *pp; pp = &(*pp)->next) {
+		if (*pp == file) {
+			*pp = file->next;
+			break;
+		}
+	}
+
+	if (file->fd >= 0)
+		close(file->fd);
+	free(file->path);
+	file->path = NULL;
+	file->next = NULL;
+	file->fd   = -1;
+	file->used = 0;
+}
+
+/* Close the files below a directory, e.g. of an interface that went away */
+static void file_drop(const char *dir)
+{
+	size_t i, len = strlen(dir);
+
+	for (i = 0; i < MAX_NR_FILES; i++) {
+		if (m_file[i].path && !strncmp(m_file[i].path, dir, len))
+			file_close(&m_file[i]);
+	}
+}
+
+static struct file_cache *file_get(const char *filename)
+{
+	struct file_cache *file;
+	unsigned int hash = file_hash(filename);
+
+	for (file = m_file_hash[hash]; file; file = file->next) {
+		if (!strcmp(file->path, filename)) {
+			file->used = 1;
+			return file;
+		}
+	}
+
+	/* Second chance replacement, ends within two rounds */
+	while (1) {
+		file = &m_file[m_file_next];
+		m_file_next = (m_file_next + 1) % MAX_NR_FILES;
+		if (!file->used)
+			break;
+		file->used = 0;
+	}
+	file_close(file);
+
+	file->path = strdup(filename);
+	if (!file->path)
+		return NULL;
+
+	file->fd   = -1;
+	file->used = 1;
+	file->next = m_file_hash[hash];
+	m_file_hash[hash] = file;
+
+	return file;
+}
+
+/* Read the whole file from the start, a /proc seq_file may return less */
+static ssize_t file_pread(struct file_cache *file)
+{
+	size_t len = 0;
+	ssize_t num;
+
+	while (1) {
+		if (len + 1 >= file->size) {
+			size_t size = file->size ? file->size * 2 : 1024;
+			char *buf;
+
+			buf = realloc(file->buf, size);
+			if (!buf)
+				return -1;
+
+			file->buf  = buf;
+			file->size = size;
+		}
+
+		num = pread(file->fd, file->buf + len, file->size - 1 - len, len);
+		if (num < 0)
+			return -1;
+		if (num == 0)
+			break;
+
+		len += num;
+	}
+
+	file->buf[len] = 0;
+
+	return len;
+}
+
+/*
+ * Returns the contents of the file, NUL terminated, in a buffer owned by
+ * the cache and valid until the next read of the same file.  Returns NULL
+ * and sets errno on error, without logging, it is up to the caller.
+ */
+char *read_file_cached(const char *filename)
+{
+	struct file_cache *file;
+	int retry = 1;
+
+	file = file_get(filename);
+	if (!file)
+		return NULL;
+
+	while (1) {
+		if (file->fd < 0) {
+			file->fd = open(filename, O_RDONLY | O_CLOEXEC);
+			if (file->fd < 0)
+				return NULL;
+		}
+
+		if (file_pread(file) >= 0)
+			return file->buf;
+
+		if (!retry-- || (errno != ENODEV && errno != ESTALE && errno != EBADF))
+			return NULL;
+
+		close(file->fd);
+		file->fd = -1;
+	}
+}
+
 int parse_file(char *file, field_t fields[], size_t limit, size_t skip_prefix)
 {
-	char buf[512];
-	FILE *fp;
+	char *buf, *next;
 
 	if (!file || !fields)
 		return -1;
 
-	fp = fopen(file, "r");
-	if (!fp)
+	buf = read_file_cached(file);
+	if (!buf)
 		return -1;
 
-	while (fgets(buf, sizeof(buf), fp)) {
+	for (; *buf; buf = next) {
 		size_t i;
 
+		next = strchr(buf, '\n');
+		if (next)
+			*next++ = 0;
+		else
+			next = buf + strlen(buf);
+
 		for (i = 0; i < limit; i++) {
 			if (!fields[i].prefix)
 				continue;
@@ -113,28 +714,72 @@ int parse_file(char *file, field_t fields[], size_t limit, size_t skip_prefix)
 		}
 	}
 
-	return fclose(fp);
+	return 0;
+}
+
+/*
+ * Like parse_file(), but for a buffer already read, e.g. by read_file_cached().
+ * Lines where the prefix is not followed by a number are taken to be
+ * headers and skipped, as in /proc/net/snmp, so all fields can be parsed
+ * in a single pass.
+ */
+int parse_text(char *buf, field_t fields[], size_t limit)
+{
+	char *line, *next;
+
+	if (!buf || !fields)
+		return -1;
+
+	for (line = buf; line && *line; line = next) {
+		char *ptr;
+		size_t i;
+
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = 0;
+
+		ptr = strchr(line, ':');
+		if (!ptr)
+			continue;
+
+		ptr++;
+		while (isspace(*ptr))
+			ptr++;
+		if (!isdigit(*ptr) && *ptr != '-')
+			continue;
+
+		for (i = 0; i < limit; i++) {
+			if (!fields[i].prefix)
+				continue;
+
+			if (parse_lineint(line, &fields[i], NULL))
+				break;
+		}
+	}
+
+	return 0;
 }
 
 int read_file(const char *filename, char *buf, size_t size)
 {
-	int ret;
-	FILE *fp;
+	char *contents;
 	size_t len;
 
-	fp = fopen(filename, "r");
-	if (!fp) {
-		logit(LOG_WARNING, errno, "Failed opening %s", filename);
+	contents = read_file_cached(filename);
+	if (!contents) {
+		logit(LOG_WARNING, errno, "Failed reading %s", filename);
 		return -1;
 	}
 
-	len = fread(buf, 1, size - 1, fp);
-	ret = fclose(fp);
-	if (len == 0 || ret == -1) {
-		logit(LOG_WARNING, errno, "Failed reading %s", filename);
+	len = strlen(contents);
+	if (len == 0) {
+		logit(LOG_WARNING, 0, "Failed reading %s", filename);
 		return -1;
 	}
+	if (len > size - 1)
+		len = size - 1;
 
+	memcpy(buf, contents, len);
 	buf[len] = '\0';
 
 	return 0;
@@ -187,51 +832,19 @@ void read_values(const char *buf, const char *prefix, unsigned int *values, int
 int read_file_value(unsigned int *val, const char *fmt, ...)
 {
 	va_list ap;
-	FILE *fp;
-	char buf[256];
-	int rc = -1;
+	char buf[256], *contents;
 
 	va_start(ap, fmt);
 	vsnprintf(buf, sizeof(buf), fmt, ap);
 	va_end(ap);
 
-	fp = fopen(buf, "r");
-	if (fp) {
-		if (fgets(buf, sizeof(buf), fp)) {
-			*val = strtoul(buf, NULL, 0);
-			rc = 0;
-		}
-
-		fclose(fp);
-	}
-
-	return rc;
-}
-
-int ticks_since(const struct timeval *tv_last, struct timeval *tv_now)
-{
-	float ticks;
-
-	if (gettimeofday(tv_now, NULL) == -1) {
-		logit(LOG_WARNING, errno, "could not get ticks");
-		return -1;
-	}
-
-	if (tv_now->tv_sec < tv_last->tv_sec || (tv_now->tv_sec == tv_last->tv_sec && tv_now->tv_usec < tv_last->tv_usec)) {
-		logit(LOG_WARNING, 0, "could not get ticks: time running backwards");
+	contents = read_file_cached(buf);
+	if (!contents || !*contents)
 		return -1;
-	}
 
-	ticks = (float)(tv_now->tv_sec - 1 - tv_last->tv_sec) * 100.0 + (float)((tv_now->tv_usec + 1000000 - tv_last->tv_usec) / 10000);
-#ifdef DEBUG
-	logit(LOG_DEBUG, 0, "seconds since last update: %.2f", ticks / 100);
-#endif
-	if (ticks < INT_MIN)
-		return INT_MIN;
-	if (ticks > INT_MAX)
-		return INT_MAX;
+	*val = strtoul(contents, NULL, 0);
 
-	return ticks;
+	return 0;
 }
 
 #ifdef DEBUG
@@ -274,7 +887,7 @@ void dump_mib(const value_t *value, int size)
 			strncpy(buf, "?", BUFSIZ);
 
 		logit(LOG_DEBUG, 0, "mib entry[%d]: oid='%s', max_length=%zu, data='%s'",
-		      i, oid_ntoa(&value[i].oid), value[i].data.max_length, buf);
+		      i, mib_oid_ntoa(&value[i].oid), value[i].data.max_length, buf);
 	}
 
 	free(buf);
@@ -282,6 +895,7 @@ void dump_mib(const value_t *value, int size)
 
 void dump_response(const response_t *response)
 {
+	const varbind_t *vb;
 	size_t i;
 	char *buf = allocate(MAX_PACKET_SIZE);
 
@@ -291,25 +905,26 @@ void dump_response(const response_t *response)
 	logit(LOG_DEBUG, 0, "response: status=%d, index=%d, nr_entries=%zu",
 	      response->error_status, response->error_index, response->value_list_length);
 	for (i = 0; i < response->value_list_length; i++) {
-		if (snmp_element_as_string(&response->value_list[i].data, buf, MAX_PACKET_SIZE) == -1)
+		if (snmp_element_as_string(response->value_list[i].data, buf, MAX_PACKET_SIZE) == -1)
 			strncpy(buf, "?", MAX_PACKET_SIZE);
 
-		logit(LOG_DEBUG, 0, "response: entry[%zu]='%s','%s'",
-		      i, oid_ntoa(&response->value_list[i].oid), buf);
+		vb = &response->value_list[i];
+		logit(LOG_DEBUG, 0, "response: entry[%zu]='%s','%s'", i,
+		      vb->value ? mib_oid_ntoa(&vb->value->oid) : oid_ntoa(vb->oid), buf);
 	}
 
 	free(buf);
 }
 #endif /* DEBUG */
 
-char *oid_ntoa(const oid_t *oid)
+static char *subid_ntoa(const unsigned int *subid_list, size_t length)
 {
 	size_t i, len = 0;
-	static char buf[MAX_NR_SUBIDS * 10 + 2];
+	static THREAD_LOCAL char buf[MAX_NR_SUBIDS * 10 + 2];
 
 	buf[0] = '\0';
-	for (i = 0; i < oid->subid_list_length; i++) {
-		len += snprintf(buf + len, sizeof(buf) - len, ".%u", oid->subid_list[i]);
+	for (i = 0; i < length; i++) {
+		len += snprintf(buf + len, sizeof(buf) - len, ".%u", subid_list[i]);
 		if (len >= sizeof(buf))
 			break;
 	}
@@ -317,6 +932,16 @@ char *oid_ntoa(const oid_t *oid)
 	return buf;
 }
 
+char *oid_ntoa(const oid_t *oid)
+{
+	return subid_ntoa(oid->subid_list, oid->subid_list_length);
+}
+
+char *mib_oid_ntoa(const mib_oid_t *oid)
+{
+	return subid_ntoa(oid->subid_list, oid->subid_list_length);
+}
+
 oid_t *oid_aton(const char *str)
 {
 	static oid_t oid;
@@ -346,28 +971,40 @@ oid_t *oid_aton(const char *str)
 	return &oid;
 }
 
-int oid_cmp(const oid_t *oid1, const oid_t *oid2)
+int subid_cmp(const unsigned int *list1, size_t len1, const unsigned int *list2, size_t len2)
 {
-	int subid1, subid2;
-	size_t i;
+	size_t i, len;
 
-	for (i = 0; i < MAX_NR_OIDS; i++) {
-		subid1 = (oid1->subid_list_length > i) ? (int)oid1->subid_list[i] : -1;
-		subid2 = (oid2->subid_list_length > i) ? (int)oid2->subid_list[i] : -1;
+	len = len1;
+	if (len > len2)
+		len = len2;
 
-		if (subid1 == -1 && subid2 == -1)
-			return 0;
-		if (subid1 > subid2)
+	for (i = 0; i < len; i++) {
+		if (list1[i] > list2[i])
 			return 1;
-		if (subid1 < subid2)
+		if (list1[i] < list2[i])
 			return -1;
 	}
 
+	/* Common prefix, the shorter OID sorts first */
+	if (len1 > len2)
+		return 1;
+	if (len1 < len2)
+		return -1;
+
 	return 0;
 }
 
-int split(const char *str, char *delim, char **list, int max_list_length)
+int oid_cmp(const oid_t *oid1, const oid_t *oid2)
 {
+	return subid_cmp(oid1->subid_list, oid1->subid_list_length,
+			 oid2->subid_list, oid2->subid_list_length);
+}
+
+/* Split str into a new list, returns the number of elements in it */
+int split(const char *str, char *delim, char ***list)
+{
+	char **arr = NULL;
 	int len = 0;
 	char *ptr;
 	char *buf = strdup(str);
@@ -376,40 +1013,315 @@ int split(const char *str, char *delim, char **list, int max_list_length)
 		return 0;
 
 	for (ptr = strtok(buf, delim); ptr; ptr = strtok(NULL, delim)) {
-		if (len < max_list_length)
-			list[len++] = strdup(ptr);
+		char **tmp;
+
+		tmp = realloc(arr, (len + 1) * sizeof(*arr));
+		if (!tmp)
+			break;
+
+		arr = tmp;
+		arr[len++] = strdup(ptr);
 	}
 
 	free(buf);
+	*list = arr;
 
 	return len;
 }
 
-client_t *find_oldest_client(void)
+int find_ifname(char *ifname)
 {
-	size_t i, found = 0, pos = 0;
-	time_t timestamp = (time_t)LONG_MAX;
+	int i;
+
+	for (i = 0; i < (int)g_interface_list_length; i++) {
+		if (!strcmp(g_interface_list[i], ifname))
+			return i;
+	}
+
+	return -1;
+}
+
+/* Check if an interface is one of the names, or matches one of the patterns, given */
+int interface_match(const char *ifname)
+{
+	size_t i;
+
+	for (i = 0; i < g_interface_glob_length; i++) {
+		if (!fnmatch(g_interface_glob[i], ifname, 0))
+			return 1;
+	}
+
+	return 0;
+}
 
-	for (i = 0; i < g_tcp_client_list_length; i++) {
-		if (timestamp > g_tcp_client_list[i]->timestamp) {
-			timestamp = g_tcp_client_list[i]->timestamp;
-			found = 1;
-			pos = i;
+/* An interface or disk found, with the index of its rows */
+struct entry {
+	unsigned int index;
+	const char  *name;
+};
+
+static int entry_cmp(const void *p1, const void *p2)
+{
+	const struct entry *a = p1;
+	const struct entry *b = p2;
+
+	if (a->index < b->index)
+		return -1;
+
+	return a->index > b->index;
+}
+
+/* Check if the entries found differ from the list, sorted by index */
+static int entries_changed(const struct entry *found, size_t num, char **list, const unsigned int *index, size_t len)
+{
+	size_t i;
+
+	if (num != len)
+		return 1;
+
+	for (i = 0; i < num; i++) {
+		if (found[i].index != index[i] || strcmp(found[i].name, list[i]))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Replace the list, and the index of each element, with the entries found */
+static int entries_set(const struct entry *found, size_t num, char ***list, unsigned int **index, size_t *len)
+{
+	unsigned int *idx;
+	char **arr;
+	size_t i;
+
+	arr = calloc(num + 1, sizeof(*arr));
+	idx = calloc(num + 1, sizeof(*idx));
+	if (!arr || !idx)
+		goto error;
+
+	for (i = 0; i < num; i++) {
+		arr[i] = strdup(found[i].name);
+		idx[i] = found[i].index;
+		if (!arr[i])
+			goto error;
+	}
+
+	for (i = 0; i < *len; i++)
+		free((*list)[i]);
+	free(*list);
+	free(*index);
+
+	*list  = arr;
+	*index = idx;
+	*len   = num;
+
+	return 0;
+error:
+	for (i = 0; arr && arr[i]; i++)
+		free(arr[i]);
+	free(arr);
+	free(idx);
+
+	return -1;
+}
+
+/* Close the cached /sys files of the interfaces no longer in the list */
+static void interface_files_drop(const struct entry *found, size_t num)
+{
+	char dir[IFNAMSIZ + 32];
+	size_t i, j;
+
+	for (i = 0; i < g_interface_list_length; i++) {
+		for (j = 0; j < num; j++) {
+			if (!strcmp(found[j].name, g_interface_list[i]))
+				break;
+		}
+		if (j < num)
+			continue;
+
+		snprintf(dir, sizeof(dir), "/sys/class/net/%s/", g_interface_list[i]);
+		file_drop(dir);
+	}
+}
+
+/*
+ * Resolve the interface names and patterns given to the interfaces of the
+ * system, in g_interface_list with their ifIndex in g_interface_index and
+ * sorted by it, like the rows of the IF-MIB.  Interfaces that do not exist
+ * are left out.  Names are looked up one by one, only patterns need a list
+ * of all interfaces.  Returns 1 if the interfaces have changed, 0 if not,
+ * and -1 on error.
+ */
+int interface_discover(void)
+{
+	struct if_nameindex *all = NULL, *ni;
+	struct entry *found;
+	size_t i, num = 0, max = g_interface_glob_length;
+	int glob = 0, changed;
+
+	for (i = 0; i < g_interface_glob_length; i++) {
+		if (strpbrk(g_interface_glob[i], "*?["))
+			glob = 1;
+	}
+
+	if (glob) {
+		all = if_nameindex();
+		if (!all) {
+			logit(LOG_WARNING, errno, "Failed listing network interfaces");
+			return -1;
+		}
+
+		for (max = 0; all[max].if_index; max++)
+			;
+	}
+
+	found = calloc(max + 1, sizeof(*found));
+	if (!found)
+		goto error;
+
+	if (glob) {
+		for (ni = all; ni->if_index; ni++) {
+			if (!interface_match(ni->if_name))
+				continue;
+
+			found[num].index  = ni->if_index;
+			found[num++].name = ni->if_name;
+		}
+	} else {
+		for (i = 0; i < g_interface_glob_length; i++) {
+			found[num].index = if_nametoindex(g_interface_glob[i]);
+			found[num].name  = g_interface_glob[i];
+			if (found[num].index)
+				num++;
 		}
 	}
 
-	return found ? g_tcp_client_list[pos] : NULL;
+	/* The same interface may be given twice */
+	qsort(found, num, sizeof(*found), entry_cmp);
+	for (i = 1; i < num; i++) {
+		if (found[i].index != found[i - 1].index)
+			continue;
+
+		memmove(&found[i], &found[i + 1], (num - i - 1) * sizeof(*found));
+		num--;
+		i--;
+	}
+
+	changed = entries_changed(found, num, g_interface_list, g_interface_index, g_interface_list_length);
+	if (changed) {
+		interface_files_drop(found, num);
+		if (entries_set(found, num, &g_interface_list, &g_interface_index, &g_interface_list_length))
+			goto error;
+		logit(LOG_DEBUG, 0, "Monitoring %zu network interfaces", num);
+	}
+
+	free(found);
+	if (all)
+		if_freenameindex(all);
+
+	return changed;
+error:
+	logit(LOG_ERR, errno, "Failed allocating interface list");
+	free(found);
+	if (all)
+		if_freenameindex(all);
+
+	return -1;
 }
 
-int find_ifname(char *ifname)
+static unsigned int m_disk_last;	/* The index given to a disk last */
+
+/* Add a disk found, unless it is already, with its index if monitored */
+static size_t disk_add(struct entry *found, size_t num, const char *name)
 {
-	int i;
+	size_t i;
 
-	for (i = 0; i < (int)g_interface_list_length; i++) {
-		if (!strcmp(g_interface_list[i], ifname))
-			return i;
+	/* The same disk may be given, or match, twice */
+	for (i = 0; i < num; i++) {
+		if (!strcmp(found[i].name, name))
+			return num;
 	}
 
+	found[num].name  = name;
+	found[num].index = 0;
+	for (i = 0; i < g_disk_list_length; i++) {
+		if (!strcmp(g_disk_list[i], name))
+			found[num].index = g_disk_index[i];
+	}
+	if (!found[num].index)
+		found[num].index = ++m_disk_last;
+
+	return num + 1;
+}
+
+/*
+ * Resolve the disks given, paths or patterns matching mount points, to
+ * g_disk_list.  Paths are always monitored, mount points only while they
+ * are mounted.  Each disk is given the next free index, which is kept as
+ * long as it is monitored, so its rows do not move when other disks come
+ * and go.  Returns 1 if the disks have changed, 0 if not, and -1 on error.
+ */
+int disk_discover(void)
+{
+	struct entry *found;
+	char **mounts = NULL;
+	size_t i, j, num = 0;
+	int len = 0, changed;
+
+	for (i = 0; i < g_disk_glob_length; i++) {
+		if (strpbrk(g_disk_glob[i], "*?["))
+			break;
+	}
+
+	/* Keep the disks monitored if the mount points cannot be listed */
+	if (i < g_disk_glob_length) {
+		len = get_mounts(&mounts);
+		if (len < 0) {
+			logit(LOG_WARNING, errno, "Failed listing mount points");
+			return 0;
+		}
+	}
+
+	found = calloc(g_disk_glob_length + len + 1, sizeof(*found));
+	if (!found)
+		goto error;
+
+	for (i = 0; i < g_disk_glob_length; i++) {
+		const char *glob = g_disk_glob[i];
+
+		if (!strpbrk(glob, "*?[")) {
+			num = disk_add(found, num, glob);
+			continue;
+		}
+
+		for (j = 0; j < (size_t)len; j++) {
+			if (!fnmatch(glob, mounts[j], 0))
+				num = disk_add(found, num, mounts[j]);
+		}
+	}
+
+	qsort(found, num, sizeof(*found), entry_cmp);
+
+	changed = entries_changed(found, num, g_disk_list, g_disk_index, g_disk_list_length);
+	if (changed) {
+		if (entries_set(found, num, &g_disk_list, &g_disk_index, &g_disk_list_length))
+			goto error;
+		logit(LOG_DEBUG, 0, "Monitoring %zu disks", num);
+	}
+
+	free(found);
+	for (j = 0; j < (size_t)len; j++)
+		free(mounts[j]);
+	free(mounts);
+
+	return changed;
+error:
+	logit(LOG_ERR, errno, "Failed allocating disk list");
+	free(found);
+	for (j = 0; j < (size_t)len; j++)
+		free(mounts[j]);
+	free(mounts);
+
 	return -1;
 }
 